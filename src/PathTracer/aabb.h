@@ -34,29 +34,24 @@ public:
 		return x;
 	}
 
+    // Slab test, branch-free: the ray's sign picks each axis's near and far
+    // plane, and the comparisons below are false for NaN, so the 0 * infinity
+    // of a ray running exactly along a plane leaves the interval unchanged.
     bool hit(const ray &r, interval ray_t) const {
         const point3 &ray_orig = r.origin();
-        const vec3 &ray_dir = r.direction();
+        const vec3 &inv_dir = r.inv_direction();
 
         for (int axis = 0; axis < 3; axis++) {
             const interval &ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis];
+            int sign = r.direction_sign(axis);
 
-            auto t0 = (ax.min - ray_orig[axis]) * adinv;
-            auto t1 = (ax.max - ray_orig[axis]) * adinv;
+            auto t_near = ((sign ? ax.max : ax.min) - ray_orig[axis]) * inv_dir[axis];
+            auto t_far = ((sign ? ax.min : ax.max) - ray_orig[axis]) * inv_dir[axis];
 
-            if (t0 < t1) {
-                if (t0 > ray_t.min) ray_t.min = t0;
-                if (t1 < ray_t.max) ray_t.max = t1;
-            } else {
-                if (t1 > ray_t.min) ray_t.min = t1;
-                if (t0 < ray_t.max) ray_t.max = t0;
-            }
-
-            if (ray_t.max <= ray_t.min)
-                return false;
+            ray_t.min = t_near > ray_t.min ? t_near : ray_t.min;
+            ray_t.max = t_far < ray_t.max ? t_far : ray_t.max;
         }
-        return true;
+        return ray_t.min < ray_t.max;
     }
 
     int longest_axis() const {
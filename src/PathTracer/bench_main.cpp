@@ -0,0 +1,281 @@
+// Renders the built-in scenes as fixed workloads and reports timings as JSON.
+//
+// Usage: PathTracerBench [--scene NAME] [--width N] [--spp N] [--seed N]
+//                        [--threads N] [--sampler independent|halton|sobol]
+//                        [--adaptive ERROR] [--gltf FILE] [--scene-file FILE]
+//                        [--save-scene FILE] [--output FILE]
+//
+// --gltf renders the given glTF file in place of the built-in scenes, with
+// the time taken to load it and build its BVHs counted in wall_seconds.
+// --save-scene writes the one scene chosen by --scene or --gltf to a scene
+// file instead of rendering it, and --scene-file renders such a file, with
+// the time taken to map it reported as bvh_build_seconds.
+//
+// Each sample traces one primary ray, so samples_per_second is the same
+// number as primary_rays_per_second.
+
+#include "gltf_loader.h"
+#include "scene_file.h"
+#include "scenes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct bench_options {
+    std::string scene;   // empty runs every scene
+    int width = 320;
+    int spp = 64;
+    uint64_t seed = 1;
+    int threads = 0;
+    std::string sampler = "sobol";
+    double adaptive_error = 0; // 0 samples every pixel fully
+    std::string gltf;    // renders this file instead of the built-in scenes
+    std::string scene_file; // likewise
+    std::string save_scene;
+    std::string output = "bench_results.json";
+};
+
+struct bench_result {
+    std::string scene;
+    int width, height, spp;
+    double wall_seconds;
+    render_stats stats;
+};
+
+static bool parse_args(int argc, char **argv, bench_options &options) {
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (!std::strcmp(argv[i], "--scene") && has_value)
+            options.scene = argv[++i];
+        else if (!std::strcmp(argv[i], "--width") && has_value)
+            options.width = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--spp") && has_value)
+            options.spp = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--seed") && has_value)
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--threads") && has_value)
+            options.threads = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--sampler") && has_value)
+            options.sampler = argv[++i];
+        else if (!std::strcmp(argv[i], "--adaptive") && has_value)
+            options.adaptive_error = std::atof(argv[++i]);
+        else if (!std::strcmp(argv[i], "--gltf") && has_value)
+            options.gltf = argv[++i];
+        else if (!std::strcmp(argv[i], "--scene-file") && has_value)
+            options.scene_file = argv[++i];
+        else if (!std::strcmp(argv[i], "--save-scene") && has_value)
+            options.save_scene = argv[++i];
+        else if (!std::strcmp(argv[i], "--output") && has_value)
+            options.output = argv[++i];
+        else
+            return false;
+    }
+    return options.sampler == "independent" || options.sampler == "halton" || options.sampler == "sobol";
+}
+
+static sampler_type parse_sampler(const std::string &name) {
+    if (name == "independent")
+        return sampler_type::independent;
+    if (name == "halton")
+        return sampler_type::halton;
+    return sampler_type::sobol;
+}
+
+struct bench_scene {
+    std::string name;
+    std::function<bool(scene_setup &)> setup; // false if the scene can't be set up
+};
+
+// The scenes chosen by --gltf or --scene.
+static std::vector<bench_scene> selected_scenes(const bench_options &options) {
+    if (!options.gltf.empty()) {
+        return { { options.gltf, [&](scene_setup &scene) {
+            return load_gltf(options.gltf, scene);
+        } } };
+    }
+
+    std::vector<bench_scene> scenes;
+    for (const auto &entry : builtin_scenes) {
+        if (!options.scene.empty() && options.scene != entry.name)
+            continue;
+        scenes.push_back({ entry.name, [&entry](scene_setup &scene) {
+            scene = entry.make();
+            return true;
+        } });
+    }
+    return scenes;
+}
+
+static void configure_camera(camera &cam, const bench_options &options) {
+    cam.image_width = options.width;
+    cam.samples_per_pixel = options.spp;
+    cam.seed = options.seed;
+    cam.thread_count = options.threads;
+    cam.pixel_sampler = parse_sampler(options.sampler);
+    cam.adaptive = options.adaptive_error > 0;
+    cam.adaptive_error = options.adaptive_error;
+    cam.output_filename.clear();
+}
+
+// Sets up a scene and renders it. Returns nothing if setup fails.
+static std::optional<bench_result> run_scene(const bench_scene &entry, const bench_options &options) {
+    // Scene setup draws random numbers too; start it from the same point
+    // every time so each run builds the same scene.
+    seed_random(options.seed, 0);
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    scene_setup scene;
+    if (!entry.setup(scene))
+        return std::nullopt;
+    camera &cam = scene.cam;
+    configure_camera(cam, options);
+
+    cam.render(scene.world, scene.lights);
+
+    std::chrono::duration<double> wall = std::chrono::high_resolution_clock::now() - start;
+    return bench_result{ entry.name, cam.image_width, cam.image_height, options.spp, wall.count(), cam.stats };
+}
+
+// Maps a scene file and renders it. Returns nothing if it can't be opened.
+static std::optional<bench_result> run_scene_file(const bench_options &options) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    scene_file file;
+    if (!file.open(options.scene_file))
+        return std::nullopt;
+    std::chrono::duration<double> open_time = std::chrono::high_resolution_clock::now() - start;
+
+    camera cam;
+    file.apply_camera(cam);
+    configure_camera(cam, options);
+
+    cam.render(file.world(), file.lights());
+    cam.stats.build_seconds = open_time.count();
+    cam.stats.sah_cost = file.sah_cost();
+
+    std::chrono::duration<double> wall = std::chrono::high_resolution_clock::now() - start;
+    return bench_result{ options.scene_file, cam.image_width, cam.image_height, options.spp, wall.count(), cam.stats };
+}
+
+static bool save_scene(const bench_scene &entry, const bench_options &options) {
+    seed_random(options.seed, 0);
+
+    scene_setup scene;
+    return entry.setup(scene) && scene_file_writer().write(scene, options.save_scene);
+}
+
+// s as a JSON string literal.
+static std::string json_string(const std::string &s) {
+    std::string quoted = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + '"';
+}
+
+// A rate, or 0 for a run too short to time; JSON has no infinity or NaN.
+static double per_second(uint64_t count, double seconds) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+static void write_json(std::ostream &out, const bench_options &options, const std::vector<bench_result> &results) {
+    out << "{\n";
+    out << "  \"threads\": " << options.threads << ",\n";
+    out << "  \"seed\": " << options.seed << ",\n";
+    out << "  \"sampler\": " << json_string(options.sampler) << ",\n";
+    out << "  \"adaptive_error\": " << options.adaptive_error << ",\n";
+    out << "  \"scenes\": [\n";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        auto render = r.stats.render_seconds;
+
+        out << "    {\n";
+        out << "      \"name\": " << json_string(r.scene) << ",\n";
+        out << "      \"width\": " << r.width << ",\n";
+        out << "      \"height\": " << r.height << ",\n";
+        out << "      \"spp\": " << r.spp << ",\n";
+        out << "      \"wall_seconds\": " << r.wall_seconds << ",\n";
+        out << "      \"bvh_build_seconds\": " << r.stats.build_seconds << ",\n";
+        out << "      \"sah_cost\": " << r.stats.sah_cost << ",\n";
+        out << "      \"render_seconds\": " << render << ",\n";
+        out << "      \"primary_rays\": " << r.stats.samples << ",\n";
+        out << "      \"total_rays\": " << r.stats.rays << ",\n";
+        out << "      \"primary_rays_per_second\": " << per_second(r.stats.samples, render) << ",\n";
+        out << "      \"total_rays_per_second\": " << per_second(r.stats.rays, render) << ",\n";
+        out << "      \"samples_per_second\": " << per_second(r.stats.samples, render) << "\n";
+        out << "    }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+int main(int argc, char **argv) {
+    bench_options options;
+    if (!parse_args(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--scene NAME] [--width N] [--spp N] [--seed N] [--threads N]"
+                  << " [--sampler independent|halton|sobol] [--adaptive ERROR] [--gltf FILE]"
+                  << " [--scene-file FILE] [--save-scene FILE] [--output FILE]\n";
+        return 1;
+    }
+
+    std::vector<bench_result> results;
+    if (!options.scene_file.empty()) {
+        std::clog << "Scene " << options.scene_file << "\n";
+        auto result = run_scene_file(options);
+        if (!result)
+            return 1;
+        results.push_back(*result);
+    } else {
+        auto scenes = selected_scenes(options);
+        if (!options.save_scene.empty()) {
+            if (scenes.size() != 1) {
+                std::cerr << "--save-scene needs one scene, from --scene or --gltf\n";
+                return 1;
+            }
+            return save_scene(scenes[0], options) ? 0 : 1;
+        }
+
+        for (const auto &entry : scenes) {
+            std::clog << "Scene " << entry.name << "\n";
+            auto result = run_scene(entry, options);
+            if (!result)
+                return 1;
+            results.push_back(*result);
+        }
+    }
+
+    if (results.empty()) {
+        std::cerr << "Unknown scene: " << options.scene << "\n";
+        return 1;
+    }
+
+    std::ofstream file(options.output);
+    if (!file) {
+        std::cerr << "Could not open " << options.output << "\n";
+        return 1;
+    }
+
+    write_json(file, options, results);
+    write_json(std::cout, options, results);
+    return 0;
+}
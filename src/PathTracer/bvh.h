@@ -5,79 +5,568 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "thread_pool.h"
 
 #include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <vector>
 
-class bvh_node : public hittable {
+// One node of a flattened BVH, laid out depth-first: an interior node's first
+// child directly follows it and `offset` holds the index of its second child.
+// A leaf stores its primitives in place as the range [offset, offset + prim_count).
+struct linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;
+    uint16_t prim_count; // 0 for interior nodes
+    uint8_t axis;
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should fill half a cache line");
+
+struct bvh_build_options {
+    int bin_count = 16;            // SAH bins per axis, clamped to [2, 32]
+    int max_leaf_size = 4;         // nodes this small may become leaves when that is cheaper
+    double traversal_cost = 1.0;   // cost of visiting a node, relative to...
+    double intersection_cost = 1.0; // ...the cost of testing one primitive
+    int thread_count = 0;          // builder threads for large inputs; 0 uses every hardware thread
+};
+
+// A BVH over an indexed set of primitives, stored as one contiguous array of
+// nodes. The owner keeps the primitives and reorders them into leaf order after
+// build(), so a leaf's primitive range is contiguous in the owner's storage.
+class linear_bvh {
 public:
-    bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {}
+    static constexpr int max_depth = 64;
 
-    bvh_node(std::vector<shared_ptr<hittable>> &objects, size_t start, size_t end) {
-        bbox = aabb::empty;
-		for (size_t object_index = start; object_index < end; ++object_index) {
-			bbox = aabb(bbox, objects[object_index]->bounding_box());
-		}
+    std::vector<linear_bvh_node> nodes;
 
-        auto axis = bbox.longest_axis();
+    // Builds the tree over prim_bounds with a binned surface area heuristic and
+    // returns, in leaf order, the index of the primitive that should sit in
+    // each slot.
+    std::vector<uint32_t> build(const std::vector<aabb> &prim_bounds, const bvh_build_options &options = {}) {
+        nodes.clear();
+        build_options = options;
+        build_options.bin_count = std::clamp(options.bin_count, 2, max_bins);
+        build_options.max_leaf_size = std::clamp(options.max_leaf_size, 1, max_leaf_prims);
 
-        auto comparator = (axis == 0) ? box_x_compare
-                        : (axis == 1) ? box_y_compare
-                        : box_z_compare;
+        std::vector<uint32_t> order(prim_bounds.size());
+        std::iota(order.begin(), order.end(), 0);
 
-        size_t object_span = end - start;
+        std::vector<point3> centroids;
+        centroids.reserve(prim_bounds.size());
+        for (const auto &box : prim_bounds)
+            centroids.push_back(box_centroid(box));
 
-        if (object_span == 1) {
-            left = right = objects[start];
-        } else if (object_span == 2) {
-            left = objects[start];
-            right = objects[start + 1];
-        } else {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+        build_context ctx{prim_bounds, centroids, order, nullptr};
 
-            auto mid = start + object_span / 2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+        if (prim_bounds.size() >= parallel_build_threshold && options.thread_count != 1) {
+            thread_pool pool(options.thread_count);
+            ctx.pool = &pool;
+            build_subtree(ctx, nodes, 0, order.size(), 0);
+        } else if (!prim_bounds.empty()) {
+            build_subtree(ctx, nodes, 0, order.size(), 0);
         }
 
-        bbox = aabb(left->bounding_box(), right->bounding_box());
+        return order;
     }
 
-    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-        if (!bbox.hit(r, ray_t))
+    // Expected cost of tracing a ray through the tree, by the same cost model
+    // the builder minimised: each node is weighted by the probability that a
+    // ray hitting the root also hits it (the ratio of their surface areas).
+    double sah_cost() const {
+        if (nodes.empty())
+            return 0.0;
+
+        auto root_area = node_area(nodes[0]);
+        if (root_area <= 0)
+            return 0.0;
+
+        double cost = 0.0;
+        for (const auto &node : nodes) {
+            auto weight = node_area(node) / root_area;
+            if (node.prim_count > 0)
+                cost += weight * node.prim_count * build_options.intersection_cost;
+            else
+                cost += weight * build_options.traversal_cost;
+        }
+        return cost;
+    }
+
+    // Walks the tree with an explicit stack, calling hit_primitive(index,
+    // ray_t) for each primitive in every leaf the ray reaches. hit_primitive
+    // returns true on a hit and shrinks ray_t.max. At each interior node the
+    // child on the near side of its split plane, going by the ray's sign
+    // along the split axis, is visited first; the far one is retested
+    // against the shrunken ray_t when popped and skipped if it now lies
+    // beyond the closest hit.
+    template <typename HitFn>
+    bool hit(const ray &r, interval ray_t, HitFn &&hit_primitive) const {
+        if (nodes.empty())
+            return false;
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const linear_bvh_node &node = nodes[current];
+
+            if (node_hit(node, r, ray_t)) {
+                if (node.prim_count > 0) {
+                    for (uint32_t i = 0; i < node.prim_count; i++) {
+                        if (hit_primitive(node.offset + i, ray_t))
+                            hit_anything = true;
+                    }
+                } else if (r.direction_sign(node.axis)) {
+                    assert(stack_size < max_depth);
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                    continue;
+                } else {
+                    assert(stack_size < max_depth);
+                    stack[stack_size++] = node.offset;
+                    current++;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    // Like hit(), but stops at the first primitive for which
+    // occluded_primitive(index) returns true, in whatever order the leaves
+    // come, and reports whether there was one.
+    template <typename AnyHitFn>
+    bool occluded(const ray &r, interval ray_t, AnyHitFn &&occluded_primitive) const {
+        if (nodes.empty())
             return false;
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
 
-        return hit_left || hit_right;
+        while (true) {
+            const linear_bvh_node &node = nodes[current];
+
+            if (node_hit(node, r, ray_t)) {
+                if (node.prim_count > 0) {
+                    for (uint32_t i = 0; i < node.prim_count; i++) {
+                        if (occluded_primitive(node.offset + i))
+                            return true;
+                    }
+                } else {
+                    assert(stack_size < max_depth);
+                    stack[stack_size++] = node.offset;
+                    current++;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+
+        return false;
     }
 
-    aabb bounding_box() const override {
-        return bbox;
+    aabb bounding_box() const {
+        if (nodes.empty())
+            return aabb::empty;
+
+        const auto &root = nodes[0];
+        return aabb(point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+                    point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
     }
 
 private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bbox;
+    static constexpr int max_bins = 32;
+    static constexpr int max_leaf_prims = 255;
+
+    bvh_build_options build_options;
+
+    // Inputs at least this large are built on a thread pool. Subtrees at
+    // least subtree_task_size are built as separate tasks, and nodes at least
+    // parallel_bin_size bin their primitives in parallel chunks. Every step
+    // merges exactly (min/max of bounds, integer counts), so the tree matches
+    // the serial build bit for bit.
+    static constexpr size_t parallel_build_threshold = 16384;
+    static constexpr size_t subtree_task_size = 4096;
+    static constexpr size_t parallel_bin_size = 65536;
+    static constexpr size_t bin_chunk_size = 16384;
+
+    struct build_context {
+        const std::vector<aabb> &prim_bounds;
+        const std::vector<point3> &centroids;
+        std::vector<uint32_t> &order;
+        thread_pool *pool;
+    };
+
+    struct split {
+        int axis = -1;
+        int bin = 0; // primitives in bins [0, bin] go left
+        double cost = infinity;
+    };
+
+    struct bin {
+        aabb bounds = aabb::empty;
+        size_t count = 0;
+    };
+
+    struct range_bounds {
+        aabb bbox = aabb::empty;
+        aabb centroid_bounds = aabb::empty;
+
+        void merge(const range_bounds &other) {
+            bbox = aabb(bbox, other.bbox);
+            centroid_bounds = aabb(centroid_bounds, other.centroid_bounds);
+        }
+    };
+
+    using axis_bins = bin[3][max_bins];
+
+    // Runs fn(chunk_start, chunk_end, chunk_index) over [start, end), in
+    // parallel when the range is large enough and a pool is available.
+    template <typename Fn>
+    static size_t for_each_chunk(const build_context &ctx, size_t start, size_t end, Fn &&fn) {
+        if (!ctx.pool || end - start < parallel_bin_size) {
+            fn(start, end, size_t(0));
+            return 1;
+        }
+
+        size_t chunk_count = (end - start + bin_chunk_size - 1) / bin_chunk_size;
+        task_group chunks(*ctx.pool);
+        for (size_t c = 0; c < chunk_count; c++) {
+            chunks.run([&, c] {
+                fn(start + c * bin_chunk_size, std::min(end, start + (c + 1) * bin_chunk_size), c);
+            });
+        }
+        chunks.wait();
+        return chunk_count;
+    }
+
+    // Builds the subtree over order[start, end) and appends it to out. Node
+    // indices in out are relative to the start of out.
+    uint32_t build_subtree(build_context &ctx, std::vector<linear_bvh_node> &out,
+                           size_t start, size_t end, int depth) const {
+        auto bounds = compute_bounds(ctx, start, end);
+        const aabb &bbox = bounds.bbox;
+        const aabb &centroid_bounds = bounds.centroid_bounds;
+
+        auto node_index = static_cast<uint32_t>(out.size());
+        out.emplace_back();
+        set_bounds(out[node_index], bbox);
+
+        size_t object_span = end - start;
+        auto make_leaf = [&] {
+            out[node_index].offset = static_cast<uint32_t>(start);
+            out[node_index].prim_count = static_cast<uint16_t>(object_span);
+            return node_index;
+        };
+
+        if (object_span == 1)
+            return make_leaf();
+
+        split best = find_split(ctx, start, end, centroid_bounds);
+        auto leaf_cost = build_options.intersection_cost * object_span;
+        size_t mid;
+        auto &order = ctx.order;
+        const auto &centroids = ctx.centroids;
+
+        // A median split takes levels_to_leaves(object_span) more levels to
+        // get down to leaves, and an SAH split never needs more than that, as
+        // it leaves at most object_span - 1 primitives on either side. Taking
+        // the SAH split only while one more level still leaves room for that
+        // keeps every leaf within max_depth, the size of the traversal stack.
+        if (best.axis >= 0 && depth + 1 + levels_to_leaves(object_span) <= max_depth) {
+            if (object_span <= static_cast<size_t>(build_options.max_leaf_size) && leaf_cost <= best.cost)
+                return make_leaf();
+
+            auto axis = best.axis;
+            auto &ax = centroid_bounds.axis_interval(axis);
+            auto first_right = std::partition(order.begin() + start, order.begin() + end, [&](uint32_t index) {
+                return bin_index(centroids[index][axis], ax) <= best.bin;
+            });
+            mid = static_cast<size_t>(first_right - order.begin());
+        } else {
+            // All centroids coincide, or the tree is getting too deep for the
+            // traversal stack: fall back to an even split by count, which
+            // halves the span every level.
+            if (object_span <= static_cast<size_t>(build_options.max_leaf_size))
+                return make_leaf();
+
+            best.axis = bbox.longest_axis();
+            mid = start + object_span / 2;
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                [&](uint32_t a, uint32_t b) { return centroids[a][best.axis] < centroids[b][best.axis]; });
+        }
+
+        uint32_t right;
+        if (ctx.pool && object_span >= subtree_task_size) {
+            // Build both halves independently, the left one as a task, then
+            // splice them in depth-first order.
+            std::vector<linear_bvh_node> left_nodes, right_nodes;
+            {
+                task_group children(*ctx.pool);
+                children.run([&] {
+                    left_nodes.reserve(2 * (mid - start));
+                    build_subtree(ctx, left_nodes, start, mid, depth + 1);
+                });
+                right_nodes.reserve(2 * (end - mid));
+                build_subtree(ctx, right_nodes, mid, end, depth + 1);
+                children.wait();
+            }
+
+            append_nodes(out, left_nodes);
+            right = append_nodes(out, right_nodes);
+        } else {
+            build_subtree(ctx, out, start, mid, depth + 1);
+            right = build_subtree(ctx, out, mid, end, depth + 1);
+        }
+
+        out[node_index].offset = right;
+        out[node_index].prim_count = 0;
+        out[node_index].axis = static_cast<uint8_t>(best.axis);
+        return node_index;
+    }
 
-    static bool box_compare(
-        const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
-    ) {
-		auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
-		auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
-		return a_axis_interval.min < b_axis_interval.min;
+    // The number of levels of even splits by count that take span primitives
+    // down to leaves of at most max_leaf_size.
+    int levels_to_leaves(size_t span) const {
+        auto leaf_size = static_cast<size_t>(build_options.max_leaf_size);
+        int levels = 0;
+        for (; span > leaf_size; span = (span + 1) / 2)
+            levels++;
+        return levels;
     }
 
-	static bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-		return box_compare(a, b, 0);
-	}
+    static uint32_t append_nodes(std::vector<linear_bvh_node> &out, const std::vector<linear_bvh_node> &subtree) {
+        auto base = static_cast<uint32_t>(out.size());
+        for (auto node : subtree) {
+            if (node.prim_count == 0)
+                node.offset += base;
+            out.push_back(node);
+        }
+        return base;
+    }
+
+    static range_bounds compute_bounds(const build_context &ctx, size_t start, size_t end) {
+        std::vector<range_bounds> partial((end - start) / bin_chunk_size + 1);
+
+        auto chunk_count = for_each_chunk(ctx, start, end, [&](size_t s, size_t e, size_t chunk) {
+            range_bounds local;
+            for (size_t i = s; i < e; i++) {
+                auto index = ctx.order[i];
+                const point3 &c = ctx.centroids[index];
+                local.bbox = aabb(local.bbox, ctx.prim_bounds[index]);
+                local.centroid_bounds = aabb(local.centroid_bounds, aabb(c, c));
+            }
+            partial[chunk] = local;
+        });
+
+        range_bounds result;
+        for (size_t c = 0; c < chunk_count; c++)
+            result.merge(partial[c]);
+        return result;
+    }
+
+    // Bins centroids along each axis and returns the cheapest plane between
+    // two bins. Returns axis -1 when every centroid lies in the same spot.
+    split find_split(const build_context &ctx, size_t start, size_t end, const aabb &centroid_bounds) const {
+        int bin_count = build_options.bin_count;
+
+        std::vector<axis_bins> partial((end - start) / bin_chunk_size + 1);
+        auto chunk_count = for_each_chunk(ctx, start, end, [&](size_t s, size_t e, size_t chunk) {
+            auto &bins = partial[chunk];
+            for (size_t i = s; i < e; i++) {
+                auto index = ctx.order[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    const interval &ax = centroid_bounds.axis_interval(axis);
+                    auto &b = bins[axis][bin_index(ctx.centroids[index][axis], ax)];
+                    b.bounds = aabb(b.bounds, ctx.prim_bounds[index]);
+                    b.count++;
+                }
+            }
+        });
+
+        axis_bins &bins = partial[0];
+        for (size_t c = 1; c < chunk_count; c++) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int i = 0; i < bin_count; i++) {
+                    bins[axis][i].bounds = aabb(bins[axis][i].bounds, partial[c][axis][i].bounds);
+                    bins[axis][i].count += partial[c][axis][i].count;
+                }
+            }
+        }
+
+        split best;
+        double node_area_inv = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            const interval &ax = centroid_bounds.axis_interval(axis);
+            if (ax.size() <= 0)
+                continue;
+
+            // Sweep from the right, then from the left, evaluating every plane.
+            double right_area[max_bins];
+            size_t right_count[max_bins];
+            aabb running = aabb::empty;
+            size_t count = 0;
+            for (int i = bin_count - 1; i > 0; i--) {
+                running = aabb(running, bins[axis][i].bounds);
+                count += bins[axis][i].count;
+                right_area[i] = surface_area(running);
+                right_count[i] = count;
+            }
+
+            if (node_area_inv == 0) {
+                auto total = aabb(running, bins[axis][0].bounds);
+                node_area_inv = 1.0 / std::fmax(surface_area(total), 1e-12);
+            }
+
+            running = aabb::empty;
+            count = 0;
+            for (int i = 0; i < bin_count - 1; i++) {
+                running = aabb(running, bins[axis][i].bounds);
+                count += bins[axis][i].count;
+                if (count == 0 || right_count[i + 1] == 0)
+                    continue;
+
+                auto cost = build_options.traversal_cost + build_options.intersection_cost * node_area_inv
+                          * (count * surface_area(running) + right_count[i + 1] * right_area[i + 1]);
+                if (cost < best.cost) {
+                    best.axis = axis;
+                    best.bin = i;
+                    best.cost = cost;
+                }
+            }
+        }
+
+        return best;
+    }
+
+    int bin_index(double centroid, const interval &ax) const {
+        int bin_count = build_options.bin_count;
+        auto b = static_cast<int>(bin_count * ((centroid - ax.min) / ax.size()));
+        return std::clamp(b, 0, bin_count - 1);
+    }
+
+    static point3 box_centroid(const aabb &box) {
+        return point3(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+    }
+
+    static double surface_area(const aabb &box) {
+        if (box.x.size() < 0)
+            return 0.0;
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    static double node_area(const linear_bvh_node &node) {
+        double d[3];
+        for (int axis = 0; axis < 3; axis++)
+            d[axis] = static_cast<double>(node.bounds_max[axis]) - node.bounds_min[axis];
+        return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+
+    // Rounds outward so the float box always contains the double one.
+    static void set_bounds(linear_bvh_node &node, const aabb &bbox) {
+        for (int axis = 0; axis < 3; axis++) {
+            const interval &ax = bbox.axis_interval(axis);
 
-	static bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-		return box_compare(a, b, 1);
-	}
+            auto lo = static_cast<float>(ax.min);
+            if (lo > ax.min) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+
+            auto hi = static_cast<float>(ax.max);
+            if (hi < ax.max) hi = std::nextafter(hi, std::numeric_limits<float>::infinity());
+
+            node.bounds_min[axis] = lo;
+            node.bounds_max[axis] = hi;
+        }
+    }
 
-	static bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-		return box_compare(a, b, 2);
-	}
+    // The same branch-free, NaN-tolerant slab test as aabb::hit.
+    static bool node_hit(const linear_bvh_node &node, const ray &r, interval ray_t) {
+        const point3 &ray_orig = r.origin();
+        const vec3 &inv_dir = r.inv_direction();
+
+        for (int axis = 0; axis < 3; axis++) {
+            int sign = r.direction_sign(axis);
+
+            double t_near = ((sign ? node.bounds_max : node.bounds_min)[axis] - ray_orig[axis]) * inv_dir[axis];
+            double t_far = ((sign ? node.bounds_min : node.bounds_max)[axis] - ray_orig[axis]) * inv_dir[axis];
+
+            ray_t.min = t_near > ray_t.min ? t_near : ray_t.min;
+            ray_t.max = t_far < ray_t.max ? t_far : ray_t.max;
+        }
+        return ray_t.min < ray_t.max;
+    }
+};
+
+class bvh_node : public hittable {
+public:
+    bvh_node(hittable_list list, const bvh_build_options &options = {})
+        : bvh_node(list.objects, 0, list.objects.size(), options) {}
+
+    bvh_node(std::vector<shared_ptr<hittable>> &objects, size_t start, size_t end,
+             const bvh_build_options &options = {}) {
+        std::vector<aabb> prim_bounds;
+        prim_bounds.reserve(end - start);
+        for (size_t object_index = start; object_index < end; ++object_index)
+            prim_bounds.push_back(objects[object_index]->bounding_box());
+
+        auto order = tree.build(prim_bounds, options);
+
+        primitives.reserve(order.size());
+        for (auto index : order)
+            primitives.push_back(objects[start + index]);
+
+        bbox = aabb::empty;
+        for (const auto &box : prim_bounds)
+            bbox = aabb(bbox, box);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return tree.hit(r, ray_t, [&](uint32_t index, interval &t) {
+            if (!primitives[index]->hit(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override {
+        return tree.occluded(r, ray_t, [&](uint32_t index) {
+            return primitives[index]->occluded(r, ray_t);
+        });
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    bool compile(scene_builder &builder) const override {
+        for (const auto &object : primitives)
+            builder.add_compiled(*object);
+        return true;
+    }
+
+    // SAH cost of the built tree; lower means cheaper traversal.
+    double sah_cost() const {
+        return tree.sah_cost();
+    }
+
+private:
+    std::vector<shared_ptr<hittable>> primitives; // in leaf order
+    linear_bvh tree;
+    aabb bbox;
 };
@@ -1,28 +1,62 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include "util.h"
 
+#include "checkpoint.h"
+#include "film.h"
 #include "hittable.h"
+#include "light_tree.h"
 #include "pdf.h"
 #include "material.h"
+#include "sampler.h"
+#include "scene.h"
+#include "thread_pool.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "include/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "include/stb_image_write.h"
 
-void write_image(const char *filename, int width, int height, int channels, unsigned char *data) {
-	stbi_write_png(filename, width, height, channels, data, width * channels);
+bool write_image(const char *filename, int width, int height, int channels, unsigned char *data) {
+	return stbi_write_png(filename, width, height, channels, data, width * channels) != 0;
 }
 
+// Writes image to filename as PFM or OpenEXR, with its linear values, if
+// the name ends in .pfm or .exr, or as a tone-mapped PNG otherwise.
+inline bool write_film(const film &image, const std::string &filename, exr_pixel_type exr_type = exr_pixel_type::half) {
+	if (filename.ends_with(".pfm"))
+		return write_pfm(image, filename);
+	if (filename.ends_with(".exr"))
+		return write_exr(image, filename, exr_type);
+
+	auto rgb = tone_map(image);
+	return write_image(filename.c_str(), image.width, image.height, 3, rgb.data());
+}
+
+// Filled in by camera::render.
+struct render_stats {
+	double build_seconds = 0;  // compiling the scene and building its BVH
+	double render_seconds = 0;
+	uint64_t samples = 0;      // one primary ray each
+	uint64_t rays = 0;         // every ray traced, primary or not
+	double sah_cost = 0;       // of the compiled scene's top-level BVH, if render compiled it
+};
+
 class camera {
 public:
 	double aspect_ratio = 1.0;
 	int image_width = 100;
 	int samples_per_pixel = 10;
 	int max_depth = 10;
+	int rr_min_depth = 3;      // bounces before Russian roulette may end a path
+	double rr_threshold = 1.0; // throughput below which it does
 	color background;
 
 	double vfov = 90;
@@ -33,10 +67,54 @@ public:
 	double defocus_angle = 0;
 	double focus_dist = 10;
 
+	int thread_count = 0; // 0 uses every hardware thread
+	int tile_size = 16;
+	uint64_t seed = 0;
+	sampler_type pixel_sampler = sampler_type::sobol;
+
+	// Adaptive sampling treats samples_per_pixel as a per-pixel cap. Pixels
+	// are sampled adaptive_min_samples at a time, and stop once the standard
+	// error of their mean luminance is below adaptive_error times that mean,
+	// leaving the rest of the budget to pixels that are still noisy. Samplers
+	// keep every prefix of a pixel's samples well spread, so stopping early
+	// costs no stratification.
+	bool adaptive = false;
+	int adaptive_min_samples = 16;
+	double adaptive_error = 0.01;
+
+	// The image is sampled in passes of pass_samples per pixel, or if 0 all
+	// at once, or in passes of checkpoint_pass_samples with a checkpoint file
+	// so there is progress to save; adaptive sampling always uses passes of
+	// adaptive_min_samples. With a checkpoint file, the film and sampling
+	// state are saved to it after a pass at most every checkpoint_interval
+	// seconds, and after the last. A render that finds a checkpoint from the
+	// same camera settings resumes from it, and finishes with the image an
+	// uninterrupted render would have made. The checkpoint doesn't record the
+	// scene, which must be the same too.
+	static constexpr int checkpoint_pass_samples = 16;
+	int pass_samples = 0;
+	std::string checkpoint_filename;
+	double checkpoint_interval = 300;
+
+	// Renders only this worker's share of the frame, for splitting it across
+	// processes; merge_partials puts the workers' checkpoints back together.
+	// Splitting by samples needs samples_per_pixel to be a multiple of
+	// worker_count and can't be combined with adaptive sampling. Passes then
+	// start from the beginning of the worker's run of samples, and are kept
+	// apart in its checkpoint so the merge can add them in order.
+	frame_split split = frame_split::none;
+	int worker_index = 0;
+	int worker_count = 1;
+
+	// Written as PFM or OpenEXR, with the linear values of the film, if the
+	// name ends in .pfm or .exr, or as a tone-mapped PNG otherwise. Empty to
+	// skip writing.
+	std::string output_filename = "output.png";
+	exr_pixel_type exr_type = exr_pixel_type::half;
+	render_stats stats;
+
 	int image_height;
 	double pixel_samples_scale;
-	int sqrt_spp;
-	double recip_sqrt_spp;
 	point3 center;
 	point3 pixel00_loc;
 	vec3 pixel_delta_u;
@@ -45,49 +123,159 @@ public:
 	vec3 defocus_disk_u;
 	vec3 defocus_disk_v;
 
-	unsigned char *imageData;
+	film image; // the samples of the last render
 
-	void render(const hittable &world, const hittable &lights) {
+	// Renders from a compiled copy of the scene and a light_tree over the
+	// lights, so scene setup code can keep building plain hittable_lists.
+	bool render(const hittable_list &world, const hittable_list &lights) {
+		auto start = std::chrono::high_resolution_clock::now();
+		compiled_scene scene(world);
+		light_tree light_set(lights);
+		std::chrono::duration<double> build_time = std::chrono::high_resolution_clock::now() - start;
+
+		bool rendered = render(static_cast<const hittable &>(scene), light_set);
+		stats.build_seconds = build_time.count();
+		stats.sah_cost = scene.sah_cost();
+		return rendered;
+	}
+
+	// Returns false if the split settings are invalid or the image can't be
+	// written.
+	bool render(const hittable &world, const hittable &lights) {
 		auto start = std::chrono::high_resolution_clock::now();
 
 		initialize();
+		stats = render_stats();
 
-		for (int j = 0; j < image_height; j++) {
-			std::clog << "\rScanlines remaining: " << image_height - j << ' ' << std::flush;
-			for (int i = 0; i < image_width; i++) {
-				color pixel_color(0, 0, 0);
-				for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-					for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-						ray r = get_ray(i, j, s_i, s_j);
-						pixel_color += ray_color(r, max_depth, world, lights);
-					}
+		// An empty light list has an empty bounding box.
+		has_lights = lights.bounding_box().x.size() >= 0;
+
+		int tiles_x = (image_width + tile_size - 1) / tile_size;
+		int tiles_y = (image_height + tile_size - 1) / tile_size;
+		int tile_count = tiles_x * tiles_y;
+
+		if (split != frame_split::none && (worker_count < 1 || worker_index < 0 || worker_index >= worker_count)) {
+			std::cerr << "Worker " << worker_index << " of " << worker_count << " is out of range\n";
+			return false;
+		}
+		if (split == frame_split::samples && (adaptive || samples_per_pixel % worker_count != 0)) {
+			std::cerr << "Splitting by samples needs a multiple of " << worker_count
+			          << " samples per pixel and no adaptive sampling\n";
+			return false;
+		}
+
+		// Splitting by tiles leaves this process every worker_count-th tile.
+		bool split_tiles = split == frame_split::tiles;
+		int share_tiles = split_tiles ? (tile_count - worker_index + worker_count - 1) / worker_count : tile_count;
+
+		// Splitting by samples leaves this process the worker_index-th run.
+		bool split_samples = split == frame_split::samples;
+		uint32_t samples_done = split_samples ? worker_index * samples_per_share() : 0;
+		uint32_t sample_count = samples_done + samples_per_share();
+		uint32_t pass_size = samples_per_pass();
+
+		statistics.assign(adaptive ? image.pixel_count() : 0, pixel_statistics());
+		passes.clear();
+		if (!checkpoint_filename.empty())
+			resume(samples_done);
+
+		thread_pool pool(thread_count);
+		std::atomic<uint64_t> total_samples(0), total_rays(0);
+		std::mutex progress_mutex;
+		auto last_checkpoint = std::chrono::steady_clock::now();
+
+		bool unfinished = samples_done < sample_count;
+		if (adaptive)
+			unfinished = std::any_of(statistics.begin(), statistics.end(),
+			                         [](const pixel_statistics &pixel) { return pixel.active != 0; });
+
+		while (unfinished) {
+			uint32_t pass_end = std::min(samples_done + pass_size, sample_count);
+			std::atomic<int> tiles_remaining(share_tiles);
+			std::atomic<bool> any_active(false);
+			film pass = split_samples ? film(image_width, image_height) : film();
+
+			{
+				// Each worker starts on its own contiguous run of tiles and
+				// steals from the others once it runs out.
+				task_group tiles(pool);
+				for (int t = 0; t < tile_count; t++) {
+					if (split_tiles && t % worker_count != worker_index)
+						continue;
+
+					int queue = static_cast<int>(static_cast<long long>(t) * pool.size() / tile_count);
+
+					tiles.run([&, t] {
+						int x0 = (t % tiles_x) * tile_size;
+						int y0 = (t / tiles_x) * tile_size;
+						int x1 = std::min(x0 + tile_size, image_width);
+						int y1 = std::min(y0 + tile_size, image_height);
+						uint64_t samples = 0, rays = 0;
+						if (adaptive) {
+							if (render_tile_adaptive(world, lights, x0, y0, x1, y1, pass_size, samples, rays))
+								any_active = true;
+						} else {
+							render_tile(world, lights, split_samples ? pass : image, x0, y0, x1, y1,
+							            samples_done, pass_end, samples, rays);
+						}
+						total_samples += samples;
+						total_rays += rays;
+
+						int remaining = --tiles_remaining;
+						std::lock_guard<std::mutex> lock(progress_mutex);
+						std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+					}, queue);
+				}
+			}
+
+			if (split_samples) {
+				image.add(pass);
+				passes.push_back(std::move(pass));
+			}
+
+			samples_done = pass_end;
+			unfinished = adaptive ? any_active.load() : samples_done < sample_count;
+
+			if (!checkpoint_filename.empty()) {
+				auto now = std::chrono::steady_clock::now();
+				std::chrono::duration<double> since = now - last_checkpoint;
+				if (!unfinished || since.count() >= checkpoint_interval) {
+					if (!write_checkpoint(checkpoint_filename, current_settings(), samples_done, !unfinished, image,
+					                      statistics, passes))
+						std::cerr << "\nCould not write " << checkpoint_filename << "\n";
+					last_checkpoint = now;
 				}
-				write_color(imageData, i, j, image_width, image_height, pixel_samples_scale * pixel_color);
 			}
 		}
 
 		std::clog << "\rDone.                 \n";
 
-		write_image("output.png", image_width, image_height, 3, imageData);
+		bool written = output_filename.empty() || write_output(output_filename);
+		if (!written)
+			std::cerr << "Could not write " << output_filename << "\n";
 
 		auto end = std::chrono::high_resolution_clock::now();
 		std::chrono::duration<double> elapsed = end - start;
 		std::clog << "Elapsed time: " << elapsed.count() << "s\n";
+
+		stats.render_seconds = elapsed.count();
+		stats.samples = total_samples;
+		stats.rays = total_rays;
+		return written;
 	}
 
 	void initialize() {
 		image_height = static_cast<int>(image_width / aspect_ratio);
 		image_height = (image_height < 1) ? 1 : image_height;
 
-		imageData = new unsigned char[image_width * image_height * 3];
+		image = film(image_width, image_height);
 
 		calculateParameters();
 	}
 
 	void calculateParameters() {
-		sqrt_spp = static_cast<int>(std::sqrt(samples_per_pixel));
-		pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
-		recip_sqrt_spp = 1.0 / sqrt_spp;
+		samples_per_pixel = std::max(samples_per_pixel, 1);
+		pixel_samples_scale = 1.0 / samples_per_pixel;
 
 		center = lookfrom;
 
@@ -114,66 +302,306 @@ public:
 		defocus_disk_v = defocus_radius * v;
 	}
 
+	// Writes the film to filename, in the format its extension names.
+	bool write_output(const std::string &filename) const {
+		return write_film(image, filename, exr_type);
+	}
+
 private:
-	ray get_ray(int i, int j, int s_i, int s_j) const {
-		auto offset = sample_square_stratified(s_i, s_j);
+	bool has_lights = false;
+
+	std::vector<pixel_statistics> statistics; // per pixel, with adaptive sampling
+	std::vector<film> passes;                 // each pass so far, when splitting by samples
+
+	// The samples per pixel this process takes: all of them, or a worker's
+	// run of them when splitting by samples.
+	uint32_t samples_per_share() const {
+		int share = split == frame_split::samples ? samples_per_pixel / worker_count : samples_per_pixel;
+		return static_cast<uint32_t>(share);
+	}
+
+	// The samples per pixel of each pass, as pass_samples describes.
+	uint32_t samples_per_pass() const {
+		if (adaptive)
+			return static_cast<uint32_t>(std::clamp(adaptive_min_samples, 1, samples_per_pixel));
+
+		auto share = samples_per_share();
+		if (pass_samples > 0)
+			return std::min(static_cast<uint32_t>(pass_samples), share);
+		if (!checkpoint_filename.empty())
+			return std::min(static_cast<uint32_t>(checkpoint_pass_samples), share);
+		return share;
+	}
+
+	checkpoint_settings current_settings() const {
+		checkpoint_settings settings;
+		settings.width = image_width;
+		settings.height = image_height;
+		settings.samples_per_pixel = samples_per_pixel;
+		settings.pass_samples = adaptive ? 0 : static_cast<int32_t>(samples_per_pass());
+		settings.max_depth = max_depth;
+		settings.rr_min_depth = rr_min_depth;
+		settings.rr_threshold = rr_threshold;
+		settings.seed = seed;
+		settings.sampler = static_cast<uint32_t>(pixel_sampler);
+		settings.adaptive = adaptive;
+		settings.adaptive_min_samples = adaptive ? adaptive_min_samples : 0;
+		settings.adaptive_error = adaptive ? adaptive_error : 0;
+		settings.tile_size = tile_size;
+		settings.split = split;
+		settings.worker_index = split == frame_split::none ? 0 : worker_index;
+		settings.worker_count = split == frame_split::none ? 1 : worker_count;
+		settings.vfov = vfov;
+		settings.lookfrom = lookfrom;
+		settings.lookat = lookat;
+		settings.vup = vup;
+		settings.defocus_angle = defocus_angle;
+		settings.focus_dist = focus_dist;
+		settings.background = background;
+		return settings;
+	}
+
+	// Picks up the film and sampling state from the checkpoint file, if
+	// there is one for the current settings.
+	void resume(uint32_t &samples_done) {
+		render_checkpoint saved;
+		if (!read_checkpoint(checkpoint_filename, saved))
+			return;
+
+		if (!(saved.settings == current_settings()) || saved.statistics.size() != statistics.size()) {
+			std::clog << "Ignoring " << checkpoint_filename << ", which has other settings\n";
+			return;
+		}
+
+		std::clog << "Resuming from " << checkpoint_filename << "\n";
+		image = std::move(saved.image);
+		statistics = std::move(saved.statistics);
+		passes = std::move(saved.passes);
+		samples_done = saved.samples_done;
+	}
+
+	// Takes samples [k0, k1) of every pixel in the tile, adding them to out.
+	void render_tile(const hittable &world, const hittable &lights, film &out, int x0, int y0, int x1, int y1,
+	                 uint32_t k0, uint32_t k1, uint64_t &samples, uint64_t &rays) {
+		auto s = make_sampler(pixel_sampler, seed);
+
+		for (int j = y0; j < y1; j++) {
+			for (int i = x0; i < x1; i++) {
+				color pixel_color(0, 0, 0);
+				for (uint32_t k = k0; k < k1; k++) {
+					s->start_pixel_sample(i, j, k);
+					ray r = get_ray(i, j, *s);
+					pixel_color += ray_color(r, world, lights, *s, rays);
+				}
+				samples += k1 - k0;
+				out.add(i, j, pixel_color, k1 - k0);
+			}
+		}
+	}
+
+	// Takes the next pass_size samples of each active pixel in the tile,
+	// tracking its mean and variance of luminance with Welford's method, and
+	// returns whether any pixel stays active. A pixel stays active only while
+	// its own relative standard error, or that of a neighbour in the tile, is
+	// above adaptive_error. Looking at the neighbours keeps a pixel whose
+	// first few samples all missed a rare bright path from stopping early
+	// when the pixels around it are noisy.
+	bool render_tile_adaptive(const hittable &world, const hittable &lights, int x0, int y0, int x1, int y1,
+	                          uint32_t pass_size, uint64_t &samples, uint64_t &rays) {
+		auto s = make_sampler(pixel_sampler, seed);
+		uint32_t sample_count = static_cast<uint32_t>(samples_per_pixel);
+		auto index = [&](int i, int j) { return static_cast<size_t>(j) * image_width + i; };
+
+		bool tile_active = false;
+		for (int j = y0; j < y1; j++)
+			for (int i = x0; i < x1; i++)
+				tile_active = tile_active || statistics[index(i, j)].active;
+		if (!tile_active)
+			return false;
+
+		for (int j = y0; j < y1; j++) {
+			for (int i = x0; i < x1; i++) {
+				auto &pixel = statistics[index(i, j)];
+				if (!pixel.active)
+					continue;
+
+				uint32_t count = image.counts[index(i, j)];
+				uint32_t pass_start = count;
+				uint32_t pass_end = std::min(count + pass_size, sample_count);
+				color pixel_color(0, 0, 0);
+
+				for (; count < pass_end; count++) {
+					s->start_pixel_sample(i, j, count);
+					ray r = get_ray(i, j, *s);
+					color sample = ray_color(r, world, lights, *s, rays);
+					pixel_color += sample;
+
+					auto l = luminance(sample);
+					if (l != l) l = 0.0;
+					auto delta = l - pixel.mean;
+					pixel.mean += delta / (count + 1);
+					pixel.m2 += delta * (l - pixel.mean);
+				}
+
+				samples += pass_end - pass_start;
+				image.add(i, j, pixel_color, pass_end - pass_start);
+
+				if (count > 1) {
+					auto standard_error = std::sqrt(pixel.m2 / (count - 1) / count);
+					pixel.error = standard_error > 0 ? standard_error / pixel.mean : 0;
+				}
+			}
+		}
+
+		bool any_active = false;
+		for (int j = y0; j < y1; j++) {
+			for (int i = x0; i < x1; i++) {
+				auto &pixel = statistics[index(i, j)];
+				if (!pixel.active)
+					continue;
+
+				double error = 0;
+				for (int nj = std::max(j - 1, y0); nj <= std::min(j + 1, y1 - 1); nj++)
+					for (int ni = std::max(i - 1, x0); ni <= std::min(i + 1, x1 - 1); ni++)
+						error = std::fmax(error, statistics[index(ni, nj)].error);
+
+				pixel.active = image.counts[index(i, j)] < sample_count && error > adaptive_error;
+				any_active = any_active || pixel.active;
+			}
+		}
+		return any_active;
+	}
+
+	ray get_ray(int i, int j, sampler &s) const {
+		auto offset = s.get_2d() - vec3(0.5, 0.5, 0);
 		auto pixel_sample = pixel00_loc
 			              + (i + offset.x()) * pixel_delta_u
 			              + (j + offset.y()) * pixel_delta_v;
 
-		auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+		// Always take the lens sample so the dimensions that follow don't
+		// shift with the defocus setting.
+		auto lens = s.get_2d();
+		auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample(lens);
 		auto ray_direction = pixel_sample - ray_origin;
-		auto ray_time = random_double();
+		auto ray_time = s.get_1d();
 
 		return ray(ray_origin, ray_direction, ray_time);
 	}
 
-	vec3 sample_square_stratified(int s_i, int s_j) const {
-		auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-		auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
-
-		return vec3(px, py, 0);
+	point3 defocus_disk_sample(const vec3 &u) const {
+		auto p = sample_unit_disk(u);
+		return center + p.x() * defocus_disk_u + p.y() * defocus_disk_v;
 	}
 
-	vec3 sample_square() const {
-		return vec3(random_double() - 0.5, random_double() - 0.5, 0);
-	}
+	// Traces one path, bounce by bounce, carrying the product of the BSDF
+	// weights so far. At every vertex with a non-specular material the path
+	// takes two samples of direct light: one towards a point on the lights
+	// (next-event estimation, with a shadow ray), and the BSDF-sampled
+	// direction the path continues along, counted if it lands on a light.
+	// The power heuristic weights the two so that each covers the cases the
+	// other samples poorly: small lights for the BSDF, glossy reflections
+	// and large lights for the light samples.
+	//
+	// Once the path is rr_min_depth bounces deep and its throughput falls
+	// below rr_threshold, Russian roulette ends it with probability 1 - q, q
+	// being the largest throughput channel, and scales survivors by 1 / q so
+	// the estimate stays unbiased.
+	color ray_color(const ray &r, const hittable &world, const hittable &lights, sampler &s, uint64_t &rays) const {
+		color radiance(0, 0, 0);
+		color throughput(1, 1, 1);
+		ray current = r;
+		double bsdf_pdf = 0; // density current was sampled with, or 0 if no light sample competed
+
+		for (int depth = 0; depth < max_depth; depth++) {
+			hit_record rec;
+
+			rays++;
+			if (!world.hit(current, interval(0.001, infinity), rec)) {
+				radiance += throughput * background;
+				break;
+			}
 
-	point3 defocus_disk_sample() const {
-		auto p = random_in_unit_disk();
-		return center + p.x() * defocus_disk_u + p.y() * defocus_disk_v;
-	}
+			// Every bounce takes the same dimensions, used or not, so that
+			// each one lines up across a pixel's samples. A material either
+			// picks its own ray from uc and u or hands back a pdf, so the two
+			// share them.
+			auto uc = s.get_1d();
+			auto u = s.get_2d();
+			auto u_light = s.get_2d();
+			auto u_rr = s.get_1d();
+
+			color emitted = shade_emitted(current, rec);
+			if (emitted.length_squared() > 0) {
+				double weight = 1;
+				if (bsdf_pdf > 0)
+					weight = power_heuristic(bsdf_pdf, lights.pdf_value(current.origin(), current.direction()));
+				radiance += weight * throughput * emitted;
+			}
 
-	color ray_color(const ray &r, int depth, const hittable &world, const hittable &lights) const {
-		if (depth <= 0)
-			return color(0, 0, 0);
+			scatter_record srec;
+			if (!shade_scatter(current, rec, srec, uc, u))
+				break;
 
-		hit_record rec;
+			if (srec.skip_pdf) {
+				throughput = throughput * srec.attenuation;
+				current = srec.skip_pdf_ray;
+				bsdf_pdf = 0;
+			} else {
+				if (has_lights)
+					radiance += throughput * sample_light(world, lights, current, rec, srec, u_light, rays);
 
-		if (!world.hit(r, interval(0.001, infinity), rec))
-			return background;
+				vec3 direction = srec.pdf.generate(u);
+				double pdf_value = srec.pdf.value(direction);
+				if (pdf_value <= 0)
+					break;
 
-		scatter_record srec;
-		color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+				ray scattered = ray(rec.p, direction, current.time());
 
-		if (!rec.mat->scatter(r, rec, srec))
-			return color_from_emission;
+				double scattering_pdf = shade_scattering_pdf(current, rec, scattered);
 
-		if (srec.skip_pdf)
-			return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+				throughput = throughput * srec.attenuation * (scattering_pdf / pdf_value);
+				current = scattered;
+				bsdf_pdf = has_lights ? pdf_value : 0;
+			}
 
-		auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-		mixture_pdf p(light_ptr, srec.pdf_ptr);
+			if (depth + 1 >= rr_min_depth) {
+				auto q = std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z()));
+				if (q < rr_threshold) {
+					if (u_rr >= q)
+						break;
+					throughput /= q;
+				}
+			}
+		}
 
-		ray scattered = ray(rec.p, p.generate(), r.time());
-		auto pdf_value = p.value(scattered.direction());
+		return radiance;
+	}
 
-		double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+	// Next-event estimation: the light arriving at rec from one point sampled
+	// on the lights, times the BSDF, weighted against BSDF sampling.
+	color sample_light(const hittable &world, const hittable &lights, const ray &r_in, const hit_record &rec,
+	                   const scatter_record &srec, const vec3 &u, uint64_t &rays) const {
+		vec3 direction = lights.random(rec.p, u);
+		double light_pdf = lights.pdf_value(rec.p, direction);
+		if (light_pdf <= 0)
+			return color(0, 0, 0);
 
-		color sample_color = ray_color(scattered, depth - 1, world, lights);
-		color color_from_scatter =
-			(srec.attenuation * scattering_pdf * sample_color) / pdf_value;
+		ray shadow(rec.p, direction, r_in.time());
+		hit_record light_rec;
+		if (!lights.hit(shadow, interval(0.001, infinity), light_rec) || !light_rec.has_material())
+			return color(0, 0, 0);
+
+		color emitted = shade_emitted(shadow, light_rec);
+		double scattering_pdf = shade_scattering_pdf(r_in, rec, shadow);
+		if (emitted.length_squared() == 0 || scattering_pdf <= 0)
+			return color(0, 0, 0);
+
+		// The light is in the world too, so stop just short of it.
+		rays++;
+		if (world.occluded(shadow, interval(0.001, light_rec.t * (1 - 1e-4))))
+			return color(0, 0, 0);
 
-		return color_from_emission + color_from_scatter;
+		double weight = power_heuristic(light_pdf, srec.pdf.value(direction));
+		return weight * srec.attenuation * scattering_pdf * emitted / light_pdf;
 	}
 };
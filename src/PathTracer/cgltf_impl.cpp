@@ -0,0 +1,4 @@
+// The one translation unit per executable that compiles cgltf itself;
+// everything else includes <cgltf.h> for the declarations only.
+#define CGLTF_IMPLEMENTATION
+#include <cgltf.h>
@@ -0,0 +1,259 @@
+#pragma once
+
+#include "util.h"
+
+#include "film.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// What adaptive sampling knows about a pixel between passes: the running
+// mean and sum of squared deviations of its samples' luminance (Welford),
+// the relative standard error they give, and whether it still needs samples.
+struct pixel_statistics {
+    double mean = 0;
+    double m2 = 0;
+    double error = infinity;
+    uint32_t active = 1;
+    uint32_t pad = 0;
+};
+
+// How a render shares one frame with others, each in its own process. With
+// tiles, worker w of n takes every nth tile from the wth. With samples, it
+// takes the wth of n equal runs of each pixel's samples, and keeps the film
+// of each of its passes apart.
+enum class frame_split : uint32_t {
+    none,
+    tiles,
+    samples,
+};
+
+// The camera settings that decide which samples a render takes and what
+// they are. A checkpoint only resumes a render whose settings match it
+// exactly. The scene itself isn't recorded.
+struct checkpoint_settings {
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t samples_per_pixel = 0;
+    int32_t pass_samples = 0;
+    int32_t max_depth = 0;
+    int32_t rr_min_depth = 0;
+    double rr_threshold = 0;
+    uint64_t seed = 0;
+    uint32_t sampler = 0;
+    uint32_t adaptive = 0;
+    int32_t adaptive_min_samples = 0;
+    int32_t tile_size = 0;
+    frame_split split = frame_split::none;
+    int32_t worker_index = 0;
+    int32_t worker_count = 1;
+    int32_t pad = 0;
+    double adaptive_error = 0;
+    double vfov = 0;
+    point3 lookfrom, lookat;
+    vec3 vup;
+    double defocus_angle = 0;
+    double focus_dist = 0;
+    color background;
+
+    bool operator==(const checkpoint_settings &other) const {
+        return std::memcmp(this, &other, sizeof(*this)) == 0;
+    }
+};
+
+// The state of a render between two passes: its film, and for adaptive
+// sampling the statistics of every pixel. Samples are fixed by the seed,
+// the pixel and the sample index, so with the sample counts in the film
+// these are all a render needs to carry on exactly where it stopped.
+struct render_checkpoint {
+    checkpoint_settings settings;
+    uint32_t samples_done = 0; // per pixel, without adaptive sampling
+    bool complete = false;     // whether the render had finished
+    film image;
+    std::vector<pixel_statistics> statistics; // empty without adaptive sampling
+    std::vector<film> passes;                 // in order; empty unless split by samples
+};
+
+namespace checkpoint_format {
+
+inline constexpr char magic[8] = { 'P', 'T', 'C', 'K', 'P', 'T', '\0', '\0' };
+inline constexpr uint32_t version = 2;
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t settings_size;
+    uint32_t statistics_size;
+    uint32_t samples_done;
+    uint32_t complete;
+    uint32_t pass_count;
+    uint64_t statistics_count;
+    checkpoint_settings settings;
+};
+
+inline void write_film_data(std::ofstream &file, const film &image) {
+    file.write(reinterpret_cast<const char *>(image.sums.data()),
+               static_cast<std::streamsize>(image.sums.size() * sizeof(float)));
+    file.write(reinterpret_cast<const char *>(image.counts.data()),
+               static_cast<std::streamsize>(image.counts.size() * sizeof(uint32_t)));
+}
+
+inline void read_film_data(std::ifstream &file, film &image) {
+    file.read(reinterpret_cast<char *>(image.sums.data()),
+              static_cast<std::streamsize>(image.sums.size() * sizeof(float)));
+    file.read(reinterpret_cast<char *>(image.counts.data()),
+              static_cast<std::streamsize>(image.counts.size() * sizeof(uint32_t)));
+}
+
+} // namespace checkpoint_format
+
+// Writes a checkpoint to path atomically: to a temporary file next to it
+// first, which then replaces path, so a job stopped at any moment leaves
+// either the old checkpoint or the new one.
+inline bool write_checkpoint(const std::string &path, const checkpoint_settings &settings, uint32_t samples_done,
+                             bool complete, const film &image, const std::vector<pixel_statistics> &statistics,
+                             const std::vector<film> &passes) {
+    using namespace checkpoint_format;
+
+    header h = {};
+    std::memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.settings_size = sizeof(checkpoint_settings);
+    h.statistics_size = sizeof(pixel_statistics);
+    h.samples_done = samples_done;
+    h.complete = complete;
+    h.pass_count = static_cast<uint32_t>(passes.size());
+    h.statistics_count = statistics.size();
+    h.settings = settings;
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        write_film_data(file, image);
+        file.write(reinterpret_cast<const char *>(statistics.data()),
+                   static_cast<std::streamsize>(statistics.size() * sizeof(pixel_statistics)));
+        for (const auto &pass : passes)
+            write_film_data(file, pass);
+        if (!file.flush())
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    return !error;
+}
+
+// Reads the checkpoint at path. Returns false if there is none, or it is
+// damaged or from another version.
+inline bool read_checkpoint(const std::string &path, render_checkpoint &checkpoint) {
+    using namespace checkpoint_format;
+
+    std::ifstream file(path, std::ios::binary);
+    header h;
+    if (!file.read(reinterpret_cast<char *>(&h), sizeof(h)))
+        return false;
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version
+        || h.settings_size != sizeof(checkpoint_settings) || h.statistics_size != sizeof(pixel_statistics)
+        || h.settings.width <= 0 || h.settings.height <= 0)
+        return false;
+
+    film image(h.settings.width, h.settings.height);
+    if (h.statistics_count != 0 && h.statistics_count != image.pixel_count())
+        return false;
+    // Every pass takes at least one sample.
+    if (h.pass_count > static_cast<uint32_t>(std::max(h.settings.samples_per_pixel, 0)))
+        return false;
+    std::vector<pixel_statistics> statistics(h.statistics_count);
+    std::vector<film> passes(h.pass_count, film(h.settings.width, h.settings.height));
+
+    read_film_data(file, image);
+    file.read(reinterpret_cast<char *>(statistics.data()),
+              static_cast<std::streamsize>(statistics.size() * sizeof(pixel_statistics)));
+    for (auto &pass : passes)
+        read_film_data(file, pass);
+    if (!file || file.peek() != std::ifstream::traits_type::eof())
+        return false;
+
+    checkpoint.settings = h.settings;
+    checkpoint.samples_done = h.samples_done;
+    checkpoint.complete = h.complete != 0;
+    checkpoint.image = std::move(image);
+    checkpoint.statistics = std::move(statistics);
+    checkpoint.passes = std::move(passes);
+    return true;
+}
+
+// Combines the finished checkpoints of the workers that split one frame
+// into the film a single render would have made. Tile shares are copied
+// into place; the passes of sample shares are added one by one, in worker
+// order, as a single render adds each pass. Either way the result matches
+// that render bit for bit, given the same pass boundaries: for sample
+// shares, a pass size that divides each worker's run of samples. Returns
+// false, saying why, if the checkpoints aren't exactly one finished share
+// each of the same render.
+inline bool merge_partials(const std::vector<render_checkpoint> &partials, film &result) {
+    if (partials.empty()) {
+        std::cerr << "No partial renders to merge\n";
+        return false;
+    }
+
+    auto expected = partials[0].settings;
+    int worker_count = expected.worker_count;
+    if (expected.split == frame_split::none || static_cast<int>(partials.size()) != worker_count) {
+        std::cerr << "Expected " << worker_count << " partial renders of a split frame, got " << partials.size() << "\n";
+        return false;
+    }
+
+    std::vector<const render_checkpoint *> by_worker(worker_count, nullptr);
+    for (const auto &partial : partials) {
+        auto settings = partial.settings;
+        int worker = settings.worker_index;
+        settings.worker_index = expected.worker_index;
+        if (!(settings == expected) || worker < 0 || worker >= worker_count || by_worker[worker]) {
+            std::cerr << "Partial render " << worker << " doesn't belong with the others\n";
+            return false;
+        }
+        if (!partial.complete) {
+            std::cerr << "Partial render " << worker << " isn't finished\n";
+            return false;
+        }
+        by_worker[worker] = &partial;
+    }
+
+    result = film(expected.width, expected.height);
+    if (expected.split == frame_split::samples) {
+        for (auto partial : by_worker)
+            for (const auto &pass : partial->passes)
+                result.add(pass);
+        return true;
+    }
+
+    // Every pixel of a worker's tiles has samples, and no other pixel does.
+    for (auto partial : by_worker) {
+        const auto &image = partial->image;
+        for (size_t p = 0; p < image.pixel_count(); p++) {
+            if (image.counts[p] == 0)
+                continue;
+            if (result.counts[p] != 0) {
+                std::cerr << "Partial render " << partial->settings.worker_index << " overlaps another\n";
+                return false;
+            }
+            result.counts[p] = image.counts[p];
+            for (int c = 0; c < 3; c++)
+                result.sums[3 * p + c] = image.sums[3 * p + c];
+        }
+    }
+
+    if (std::find(result.counts.begin(), result.counts.end(), 0u) != result.counts.end()) {
+        std::cerr << "The partial renders leave pixels uncovered\n";
+        return false;
+    }
+    return true;
+}
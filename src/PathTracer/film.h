@@ -0,0 +1,243 @@
+#pragma once
+
+#include "util.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A linear HDR image being accumulated: for each pixel, the float sums of
+// the red, green and blue of the samples taken so far, and how many there
+// were. A pixel's value is its sum over its count. Films of one size add
+// together, so renders done in passes, resumed or split across processes
+// combine without going through a quantized image; tone mapping to 8 bits
+// happens only when a PNG is written.
+class film {
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<float> sums;      // red, green and blue per pixel, rows top to bottom
+    std::vector<uint32_t> counts; // samples per pixel
+
+    film() = default;
+
+    film(int width, int height)
+        : width(width), height(height), sums(3 * pixel_count()), counts(pixel_count()) {}
+
+    size_t pixel_count() const {
+        return static_cast<size_t>(width) * height;
+    }
+
+    // Adds the sum of count samples to pixel (i, j).
+    void add(int i, int j, const color &sum, uint32_t count) {
+        auto p = static_cast<size_t>(j) * width + i;
+        sums[3 * p + 0] += static_cast<float>(sum.x());
+        sums[3 * p + 1] += static_cast<float>(sum.y());
+        sums[3 * p + 2] += static_cast<float>(sum.z());
+        counts[p] += count;
+    }
+
+    // Adds every pixel of other, which must be the same size.
+    void add(const film &other) {
+        for (size_t k = 0; k < sums.size(); k++)
+            sums[k] += other.sums[k];
+        for (size_t p = 0; p < counts.size(); p++)
+            counts[p] += other.counts[p];
+    }
+
+    // The estimate of pixel (i, j), or black if it has no samples.
+    color value(int i, int j) const {
+        auto p = static_cast<size_t>(j) * width + i;
+        if (counts[p] == 0)
+            return color(0, 0, 0);
+        auto scale = 1.0 / counts[p];
+        return color(scale * sums[3 * p + 0], scale * sums[3 * p + 1], scale * sums[3 * p + 2]);
+    }
+};
+
+// The nearest half-precision float to f, with ties to even. Too large
+// values become infinity, and NaN stays NaN.
+inline uint16_t float_to_half(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t magnitude = x & 0x7fffffff;
+    uint32_t exponent = magnitude >> 23;
+
+    if (magnitude >= 0x7f800000)
+        return static_cast<uint16_t>(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0));
+    if (magnitude >= 0x477ff000) // 65520 and up round past the largest half
+        return static_cast<uint16_t>(sign | 0x7c00);
+
+    uint32_t half, remainder, halfway;
+    if (exponent >= 113) {
+        half = ((exponent - 112) << 10) | ((magnitude >> 13) & 0x3ff);
+        remainder = magnitude & 0x1fff;
+        halfway = 0x1000;
+    } else if (exponent >= 102) {
+        // Subnormal: count units of 2^-24.
+        uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - exponent;
+        half = mantissa >> shift;
+        remainder = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        return static_cast<uint16_t>(sign);
+    }
+
+    // A carry out of the mantissa steps the exponent up, which is right.
+    if (remainder > halfway || (remainder == halfway && (half & 1)))
+        half++;
+    return static_cast<uint16_t>(sign | half);
+}
+
+namespace film_io {
+
+inline void put_u32(std::vector<char> &out, uint32_t v) {
+    for (int k = 0; k < 4; k++)
+        out.push_back(static_cast<char>((v >> (8 * k)) & 0xff));
+}
+
+inline void put_u64(std::vector<char> &out, uint64_t v) {
+    for (int k = 0; k < 8; k++)
+        out.push_back(static_cast<char>((v >> (8 * k)) & 0xff));
+}
+
+inline void put_f32(std::vector<char> &out, float f) {
+    uint32_t v;
+    std::memcpy(&v, &f, sizeof(v));
+    put_u32(out, v);
+}
+
+inline void put_string(std::vector<char> &out, const char *s) {
+    out.insert(out.end(), s, s + std::strlen(s) + 1);
+}
+
+inline bool write_file(const std::string &path, const std::vector<char> &bytes) {
+    std::ofstream file(path, std::ios::binary);
+    return file.write(bytes.data(), static_cast<std::streamsize>(bytes.size())) && file.flush();
+}
+
+} // namespace film_io
+
+// Writes the film's estimate as a little-endian PFM: float RGB, bottom row
+// first.
+inline bool write_pfm(const film &image, const std::string &path) {
+    using namespace film_io;
+
+    std::string header = "PF\n" + std::to_string(image.width) + " " + std::to_string(image.height) + "\n-1.0\n";
+    std::vector<char> out(header.begin(), header.end());
+    out.reserve(out.size() + 12 * image.pixel_count());
+
+    for (int j = image.height - 1; j >= 0; j--) {
+        for (int i = 0; i < image.width; i++) {
+            auto c = image.value(i, j);
+            put_f32(out, static_cast<float>(c.x()));
+            put_f32(out, static_cast<float>(c.y()));
+            put_f32(out, static_cast<float>(c.z()));
+        }
+    }
+
+    return write_file(path, out);
+}
+
+enum class exr_pixel_type : uint32_t {
+    half = 1,
+    float32 = 2,
+};
+
+// Writes the film's estimate as a single-part, uncompressed, scanline
+// OpenEXR file with half or float R, G and B channels.
+inline bool write_exr(const film &image, const std::string &path, exr_pixel_type type = exr_pixel_type::half) {
+    using namespace film_io;
+
+    std::vector<char> out;
+    put_u32(out, 20000630); // magic number
+    put_u32(out, 2);        // version 2, single-part scanline
+
+    auto attribute = [&](const char *name, const char *type_name, uint32_t size) {
+        put_string(out, name);
+        put_string(out, type_name);
+        put_u32(out, size);
+    };
+
+    // Channels are listed in alphabetical order, and stored in it too.
+    const char *channels[] = { "B", "G", "R" };
+    attribute("channels", "chlist", 3 * (2 + 16) + 1);
+    for (auto name : channels) {
+        put_string(out, name);
+        put_u32(out, static_cast<uint32_t>(type));
+        put_u32(out, 0); // pLinear and reserved
+        put_u32(out, 1); // x sampling
+        put_u32(out, 1); // y sampling
+    }
+    out.push_back(0);
+
+    attribute("compression", "compression", 1);
+    out.push_back(0); // none
+
+    for (auto window : { "dataWindow", "displayWindow" }) {
+        attribute(window, "box2i", 16);
+        put_u32(out, 0);
+        put_u32(out, 0);
+        put_u32(out, static_cast<uint32_t>(image.width - 1));
+        put_u32(out, static_cast<uint32_t>(image.height - 1));
+    }
+
+    attribute("lineOrder", "lineOrder", 1);
+    out.push_back(0); // increasing y
+
+    attribute("pixelAspectRatio", "float", 4);
+    put_f32(out, 1.0f);
+
+    attribute("screenWindowCenter", "v2f", 8);
+    put_f32(out, 0.0f);
+    put_f32(out, 0.0f);
+
+    attribute("screenWindowWidth", "float", 4);
+    put_f32(out, 1.0f);
+
+    out.push_back(0); // end of header
+
+    // Uncompressed files hold one scanline per chunk, found through a table
+    // of their offsets.
+    size_t sample_size = type == exr_pixel_type::half ? 2 : 4;
+    size_t line_size = 3 * sample_size * image.width;
+    uint64_t chunk_offset = out.size() + 8 * static_cast<uint64_t>(image.height);
+    for (int j = 0; j < image.height; j++)
+        put_u64(out, chunk_offset + j * (8 + line_size));
+
+    std::vector<color> line(image.width);
+    for (int j = 0; j < image.height; j++) {
+        put_u32(out, static_cast<uint32_t>(j));
+        put_u32(out, static_cast<uint32_t>(line_size));
+
+        for (int i = 0; i < image.width; i++)
+            line[i] = image.value(i, j);
+
+        for (int channel = 2; channel >= 0; channel--) {
+            for (int i = 0; i < image.width; i++) {
+                auto f = static_cast<float>(line[i][channel]);
+                if (type == exr_pixel_type::float32) {
+                    put_f32(out, f);
+                } else {
+                    auto h = float_to_half(f);
+                    out.push_back(static_cast<char>(h & 0xff));
+                    out.push_back(static_cast<char>(h >> 8));
+                }
+            }
+        }
+    }
+
+    return write_file(path, out);
+}
+
+// The film tone mapped to 8-bit RGB, as write_color maps each pixel.
+inline std::vector<unsigned char> tone_map(const film &image) {
+    std::vector<unsigned char> rgb(3 * image.pixel_count());
+    for (int j = 0; j < image.height; j++)
+        for (int i = 0; i < image.width; i++)
+            write_color(rgb.data(), i, j, image.width, image.height, image.value(i, j));
+    return rgb;
+}
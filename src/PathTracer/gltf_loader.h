@@ -0,0 +1,236 @@
+#pragma once
+
+#include "util.h"
+
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "scene.h"
+#include "scenes.h"
+#include "transform.h"
+#include "triangle_mesh.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <cgltf.h>
+
+// Reads a glTF 2.0 scene (.gltf or .glb) with cgltf. Every mesh becomes
+// triangle_mesh buffers filled straight from its accessors, built once with
+// its own BVH however many nodes use it, and every node that uses a mesh
+// becomes an instance of it under the node's world transform. Materials come
+// from the metallic-roughness base colour and the emissive factors, with
+// KHR_materials_transmission, _ior and _emissive_strength where present;
+// textures are ignored. The first camera in the scene sets the view, or the
+// view is fitted to the scene if there is none.
+//
+// Emissive meshes light the scene when rays happen to hit them, but aren't
+// sampled directly: scene.lights is left empty.
+namespace gltf {
+
+inline shared_ptr<material> convert_material(const cgltf_material *m) {
+    if (!m)
+        return make_shared<lambertian>(color(0.8, 0.8, 0.8));
+
+    color emission(m->emissive_factor[0], m->emissive_factor[1], m->emissive_factor[2]);
+    if (m->has_emissive_strength)
+        emission *= m->emissive_strength.emissive_strength;
+    if (emission.x() > 0 || emission.y() > 0 || emission.z() > 0)
+        return make_shared<diffuse_light>(emission);
+
+    color base(1, 1, 1);
+    double metallic = 1, roughness = 1;
+    if (m->has_pbr_metallic_roughness) {
+        const auto &pbr = m->pbr_metallic_roughness;
+        base = color(pbr.base_color_factor[0], pbr.base_color_factor[1], pbr.base_color_factor[2]);
+        metallic = pbr.metallic_factor;
+        roughness = pbr.roughness_factor;
+    }
+
+    if (m->has_transmission && m->transmission.transmission_factor > 0.5)
+        return make_shared<dielectric>(m->has_ior ? m->ior.ior : 1.5);
+    if (metallic > 0.5)
+        return make_shared<metal>(base, roughness);
+    return make_shared<lambertian>(base);
+}
+
+// Unpacks a float accessor of vec3 or vec2 elements into buffer, one vec3
+// per element with any missing components zero. Returns false if the
+// accessor can't be read.
+inline bool read_vectors(const cgltf_accessor *accessor, std::vector<vec3> &buffer) {
+    auto components = cgltf_num_components(accessor->type);
+    if (components < 2 || components > 3)
+        return false;
+
+    std::vector<float> floats(accessor->count * components);
+    if (cgltf_accessor_unpack_floats(accessor, floats.data(), floats.size()) != floats.size())
+        return false;
+
+    buffer.resize(accessor->count);
+    for (size_t i = 0; i < accessor->count; i++) {
+        const float *f = &floats[i * components];
+        buffer[i] = vec3(f[0], f[1], components == 3 ? f[2] : 0);
+    }
+    return true;
+}
+
+// Unpacks an index accessor into indices. Returns false if the accessor
+// can't be read, as cgltf can't for sparse ones or without a buffer view.
+inline bool read_indices(const cgltf_accessor *accessor, std::vector<uint32_t> &indices) {
+    indices.resize(accessor->count);
+    return cgltf_accessor_unpack_indices(accessor, indices.data(), sizeof(uint32_t), indices.size()) == indices.size();
+}
+
+// Converts the triangle primitives of a mesh. Returns null if it has none.
+inline shared_ptr<hittable> convert_mesh(const cgltf_mesh &mesh,
+                                         std::unordered_map<const cgltf_material *, shared_ptr<material>> &materials) {
+    hittable_list parts;
+
+    for (size_t p = 0; p < mesh.primitives_count; p++) {
+        const cgltf_primitive &primitive = mesh.primitives[p];
+        if (primitive.type != cgltf_primitive_type_triangles)
+            continue;
+
+        mesh_buffers buffers;
+        bool has_positions = false;
+        for (size_t a = 0; a < primitive.attributes_count; a++) {
+            const cgltf_attribute &attribute = primitive.attributes[a];
+            if (attribute.type == cgltf_attribute_type_position)
+                has_positions = read_vectors(attribute.data, buffers.positions);
+            else if (attribute.type == cgltf_attribute_type_normal)
+                read_vectors(attribute.data, buffers.normals);
+            else if (attribute.type == cgltf_attribute_type_texcoord && attribute.index == 0)
+                read_vectors(attribute.data, buffers.uvs);
+        }
+        if (!has_positions)
+            continue;
+        if (buffers.normals.size() != buffers.positions.size())
+            buffers.normals.clear();
+        if (buffers.uvs.size() != buffers.positions.size())
+            buffers.uvs.clear();
+
+        if (primitive.indices) {
+            if (!read_indices(primitive.indices, buffers.indices))
+                continue;
+        } else {
+            buffers.indices.resize(buffers.positions.size());
+            for (size_t i = 0; i < buffers.indices.size(); i++)
+                buffers.indices[i] = static_cast<uint32_t>(i);
+        }
+
+        auto &mat = materials[primitive.material];
+        if (!mat)
+            mat = convert_material(primitive.material);
+
+        parts.add(make_shared<triangle_mesh>(std::move(buffers), mat));
+    }
+
+    if (parts.objects.empty())
+        return nullptr;
+    if (parts.objects.size() == 1)
+        return parts.objects[0];
+    return make_shared<compiled_scene>(parts);
+}
+
+// glTF matrices are column-major.
+inline transform to_transform(const float m[16]) {
+    return transform::from_rows(m[0], m[4], m[8], m[12],
+                                m[1], m[5], m[9], m[13],
+                                m[2], m[6], m[10], m[14]);
+}
+
+struct load_state {
+    const cgltf_data *data = nullptr;
+    std::vector<shared_ptr<hittable>> meshes; // per glTF mesh, converted on first use
+    std::vector<bool> converted;
+    std::unordered_map<const cgltf_material *, shared_ptr<material>> materials;
+    bool has_camera = false;
+};
+
+inline void add_node(load_state &state, const cgltf_node *node, const transform &parent, scene_setup &scene) {
+    float local[16];
+    cgltf_node_transform_local(node, local);
+    auto to_world = parent * to_transform(local);
+
+    if (node->mesh) {
+        auto index = static_cast<size_t>(node->mesh - state.data->meshes);
+        if (!state.converted[index]) {
+            state.meshes[index] = convert_mesh(*node->mesh, state.materials);
+            state.converted[index] = true;
+        }
+        if (state.meshes[index])
+            scene.world.add(make_shared<instance>(state.meshes[index], to_world));
+    }
+
+    if (node->camera && !state.has_camera && node->camera->type == cgltf_camera_type_perspective) {
+        // glTF cameras look down -z with +y up.
+        const auto &perspective = node->camera->data.perspective;
+        camera &cam = scene.cam;
+        cam.lookfrom = to_world.apply_point(point3(0, 0, 0));
+        cam.lookat = cam.lookfrom + to_world.apply_vector(vec3(0, 0, -1));
+        cam.vup = to_world.apply_vector(vec3(0, 1, 0));
+        cam.vfov = perspective.yfov * 180 / pi;
+        if (perspective.has_aspect_ratio && perspective.aspect_ratio > 0)
+            cam.aspect_ratio = perspective.aspect_ratio;
+        state.has_camera = true;
+    }
+
+    for (size_t i = 0; i < node->children_count; i++)
+        add_node(state, node->children[i], to_world, scene);
+}
+
+} // namespace gltf
+
+// Loads the glTF file at path into scene. Returns false, after reporting the
+// reason on std::cerr, if the file can't be read or parsed.
+inline bool load_gltf(const std::string &path, scene_setup &scene) {
+    cgltf_options options = {};
+    cgltf_data *data = nullptr;
+
+    auto result = cgltf_parse_file(&options, path.c_str(), &data);
+    if (result == cgltf_result_success)
+        result = cgltf_load_buffers(&options, data, path.c_str());
+    if (result == cgltf_result_success)
+        result = cgltf_validate(data);
+    if (result != cgltf_result_success) {
+        std::cerr << "Could not load " << path << " (cgltf error " << result << ")\n";
+        cgltf_free(data);
+        return false;
+    }
+
+    gltf::load_state state;
+    state.data = data;
+    state.meshes.resize(data->meshes_count);
+    state.converted.resize(data->meshes_count);
+
+    // Without a default scene, every root node is in the scene.
+    if (data->scene) {
+        for (size_t i = 0; i < data->scene->nodes_count; i++)
+            gltf::add_node(state, data->scene->nodes[i], transform::identity(), scene);
+    } else {
+        for (size_t i = 0; i < data->nodes_count; i++) {
+            if (!data->nodes[i].parent)
+                gltf::add_node(state, &data->nodes[i], transform::identity(), scene);
+        }
+    }
+
+    cgltf_free(data);
+
+    camera &cam = scene.cam;
+    cam.background = color(0.70, 0.80, 1.00);
+    cam.defocus_angle = 0;
+
+    if (!state.has_camera) {
+        // Look at the middle of the scene from far enough back to see it all.
+        auto box = scene.world.bounding_box();
+        point3 center(0.5 * (box.x.min + box.x.max), 0.5 * (box.y.min + box.y.max), 0.5 * (box.z.min + box.z.max));
+        auto radius = 0.5 * vec3(box.x.size(), box.y.size(), box.z.size()).length();
+        cam.vfov = 40;
+        cam.lookat = center;
+        cam.lookfrom = center + vec3(0, 0, radius / std::tan(degrees_to_radians(cam.vfov / 2)));
+        cam.vup = vec3(0, 1, 0);
+    }
+
+    return true;
+}
@@ -3,12 +3,20 @@
 #include "aabb.h"
 
 class material;
+class scene_builder;
+struct material_record;
+struct texture_record;
 
 class hit_record {
 public:
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> mat;
+	// The material that was hit: an object, owned by the primitive, or else
+	// a record in a compiled scene's table, whose texture indices address
+	// textures. shade_scatter() and its kin take either.
+	const material *mat;
+	const material_record *mat_record;
+	const texture_record *textures;
 	double t;
 	double u;
 	double v;
@@ -18,6 +26,28 @@ public:
 		front_face = dot(r.direction(), outward_normal) < 0;
 		normal = front_face ? outward_normal : -outward_normal;
 	}
+
+	void set_material(const material *object) {
+		mat = object;
+		mat_record = nullptr;
+		textures = nullptr;
+	}
+
+	bool has_material() const {
+		return mat || mat_record;
+	}
+};
+
+// What a light sampler needs to know about an emitter: where it is, how much
+// power it emits, and which way. The emitter's surface normals lie within
+// theta_o of w, and it emits into directions within theta_e of a normal.
+struct light_bounds {
+	aabb bounds;
+	vec3 w = vec3(0, 0, 1);
+	double phi = 0;          // emitted power; 0 for objects that don't emit
+	double cos_theta_o = -1; // normals in every direction
+	double cos_theta_e = 0;  // emits over the hemisphere about each normal
+	bool two_sided = false;
 };
 
 class hittable {
@@ -26,15 +56,39 @@ public:
 
 	virtual bool hit(const ray &r, interval ray_t, hit_record &rec) const = 0;
 
+	// Whether anything blocks r within ray_t. Unlike hit(), this may stop at
+	// the first intersection it finds and fills in no hit_record, so it is
+	// the cheaper query for shadow rays.
+	virtual bool occluded(const ray &r, interval ray_t) const {
+		hit_record rec;
+		return hit(r, ray_t, rec);
+	}
+
 	virtual aabb bounding_box() const = 0;
 
 	virtual double pdf_value(const point3 &origin, const vec3 &direction) const {
 		return 0.0;
 	}
 
-	virtual vec3 random(const point3 &origin) const {
+	// Returns a direction from origin towards this object, chosen by the 2D
+	// sample u with the density pdf_value() reports.
+	virtual vec3 random(const point3 &origin, const vec3 &u) const {
 		return vec3(1, 0, 0);
 	}
+
+	// Describes this object as a light for light_tree. Objects that don't
+	// know their emission report no power, and are never picked.
+	virtual light_bounds bounds_as_light() const {
+		light_bounds b;
+		b.bounds = bounding_box();
+		return b;
+	}
+
+	// Adds this object's primitives to a compiled scene. Objects that have no
+	// compact form return false and are kept by pointer instead.
+	virtual bool compile(scene_builder &builder) const {
+		return false;
+	}
 };
 
 class translate : public hittable {
@@ -54,10 +108,16 @@ public:
 		return true;
 	}
 
+	bool occluded(const ray &r, interval ray_t) const override {
+		return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+	}
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
 
+	bool compile(scene_builder &builder) const override;
+
 private:
 	shared_ptr<hittable> object;
 	vec3 offset;
@@ -99,18 +159,7 @@ public:
 	}
 
 	bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-		auto origin = r.origin();
-		auto direction = r.direction();
-
-		origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-		origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-		direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-		direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-		ray rotated_r(origin, direction, r.time());
-
-		if (!object->hit(rotated_r, ray_t, rec))
+		if (!object->hit(to_object(r), ray_t, rec))
 			return false;
 
 		auto p = rec.p;
@@ -127,13 +176,36 @@ public:
 		return true;
 	}
 
+	bool occluded(const ray &r, interval ray_t) const override {
+		return object->occluded(to_object(r), ray_t);
+	}
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
 
+	bool compile(scene_builder &builder) const override;
+
 private:
 	shared_ptr<hittable> object;
 	double sin_theta;
 	double cos_theta;
 	aabb bbox;
+
+	// Rotates a world-space ray into the object's frame.
+	ray to_object(const ray &r) const {
+		auto origin = r.origin();
+		auto direction = r.direction();
+
+		origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
+		origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
+
+		direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
+		direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
+
+		return ray(origin, direction, r.time());
+	}
 };
+
+// Defines the compile() overrides above.
+#include "scene_builder.h"
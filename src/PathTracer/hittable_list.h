@@ -3,6 +3,7 @@
 #include "aabb.h"
 #include "hittable.h"
 
+#include <algorithm>
 #include <vector>
 
 class hittable_list : public hittable {
@@ -35,6 +36,14 @@ public:
         return hit_anything;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override {
+        for (const auto &object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
@@ -49,9 +58,22 @@ public:
         return sum;
     }
 
-    vec3 random(const point3 &origin) const override {
-        auto int_size = int(objects.size());
-        return objects[random_int(0, int_size - 1)]->random(origin);
+    vec3 random(const point3 &origin, const vec3 &u) const override {
+        if (objects.empty())
+            return hittable::random(origin, u);
+
+        // Picks an object with u.x(), then stretches the part of u.x() that
+        // fell within that object's slot back over [0, 1) for it to use.
+        auto scaled = u.x() * objects.size();
+        auto index = std::min(static_cast<size_t>(scaled), objects.size() - 1);
+        auto remapped = std::fmin(scaled - index, 1 - 0x1p-53);
+        return objects[index]->random(origin, vec3(remapped, u.y(), 0));
+    }
+
+    bool compile(scene_builder &builder) const override {
+        for (const auto &object : objects)
+            builder.add_compiled(*object);
+        return true;
     }
 
 private:
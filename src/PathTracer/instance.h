@@ -0,0 +1,49 @@
+#pragma once
+
+#include "util.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+// A copy of object placed in the world by an affine transform. The object is
+// shared, not copied: build it once, usually as a compiled_scene so it has
+// its own BVH, and place it as many times as needed. A compiled scene keeps
+// instances in the top level of a two-level hierarchy, and each one costs
+// a pair of matrices however large the object is.
+//
+// Instances aren't light sources for light sampling: pdf_value() and
+// random() keep their defaults.
+class instance : public hittable {
+public:
+    instance(shared_ptr<hittable> object, const transform &to_world) : object(object) {
+        data.to_world = to_world;
+        data.to_object = to_world.inverse();
+        data.object = 0;
+        data.pad = 0;
+        bbox = data.bounding_box(*object);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return data.hit(*object, r, ray_t, rec);
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override {
+        return data.occluded(*object, r, ray_t);
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    bool compile(scene_builder &builder) const override {
+        auto placed = data;
+        placed.object = builder.add_shared_object(object.get());
+        builder.add(placed);
+        return true;
+    }
+
+private:
+    shared_ptr<hittable> object;
+    instance_data data;
+    aabb bbox;
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "util.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <vector>
+
+// A set of lights to sample, organised as a BVH whose nodes also bound the
+// power and emission directions of the lights below them (after Conty
+// Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree
+// Splitting", 2018, as adopted by pbrt-v4). random() walks from the root to a
+// single light, at each node choosing a child in proportion to an estimate
+// of how much light it sends towards the shading point; pdf_value() retraces
+// the same choices for the lights a direction hits. Both take time
+// logarithmic in the number of lights rather than linear, and bright or
+// nearby lights are picked more often than dim or distant ones.
+class light_tree : public hittable {
+public:
+    explicit light_tree(const hittable_list &light_list) {
+        std::vector<aabb> prim_bounds;
+        std::vector<light_bounds> all_bounds;
+        prim_bounds.reserve(light_list.objects.size());
+        all_bounds.reserve(light_list.objects.size());
+        for (const auto &light : light_list.objects) {
+            all_bounds.push_back(light->bounds_as_light());
+            prim_bounds.push_back(all_bounds.back().bounds);
+        }
+
+        bvh_build_options options;
+        options.max_leaf_size = 1;
+        auto order = tree.build(prim_bounds, options);
+
+        lights.reserve(order.size());
+        bounds.reserve(order.size());
+        for (auto index : order) {
+            lights.push_back(light_list.objects[index]);
+            bounds.push_back(all_bounds[index]);
+        }
+
+        bbox = aabb::empty;
+        for (const auto &box : prim_bounds)
+            bbox = aabb(bbox, box);
+
+        node_bounds.resize(tree.nodes.size());
+        parents.resize(tree.nodes.size());
+        leaves.resize(lights.size());
+        if (!tree.nodes.empty())
+            build_node_bounds(0, 0);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return tree.hit(r, ray_t, [&](uint32_t index, interval &t) {
+            if (!lights[index]->hit(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override {
+        return tree.occluded(r, ray_t, [&](uint32_t index) {
+            return lights[index]->occluded(r, ray_t);
+        });
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    double pdf_value(const point3 &origin, const vec3 &direction) const override {
+        // Every light the direction passes through could have produced it.
+        double sum = 0;
+        tree.hit(ray(origin, direction), interval(0.001, infinity), [&](uint32_t index, interval &) {
+            auto light_pdf = lights[index]->pdf_value(origin, direction);
+            if (light_pdf > 0)
+                sum += pick_probability(origin, index) * light_pdf;
+            return false;
+        });
+        return sum;
+    }
+
+    vec3 random(const point3 &origin, const vec3 &u) const override {
+        if (tree.nodes.empty())
+            return hittable::random(origin, u);
+
+        // Each choice uses up part of u.x(), stretching what's left back
+        // over [0, 1) for the next.
+        double ux = u.x();
+        uint32_t current = 0;
+        while (true) {
+            const auto &node = tree.nodes[current];
+            if (node.prim_count > 0) {
+                double total = 0;
+                for (uint32_t i = 0; i < node.prim_count; i++)
+                    total += importance(origin, bounds[node.offset + i]);
+                if (total <= 0)
+                    return hittable::random(origin, u);
+
+                uint32_t i = 0;
+                double target = ux * total;
+                for (; i + 1 < node.prim_count; i++) {
+                    auto weight = importance(origin, bounds[node.offset + i]);
+                    if (target < weight)
+                        break;
+                    target -= weight;
+                }
+                ux = std::fmin(target / importance(origin, bounds[node.offset + i]), 1 - 0x1p-53);
+                return lights[node.offset + i]->random(origin, vec3(ux, u.y(), 0));
+            }
+
+            auto left = importance(origin, node_bounds[current + 1]);
+            auto right = importance(origin, node_bounds[node.offset]);
+            if (left + right <= 0)
+                return hittable::random(origin, u);
+
+            auto p_left = left / (left + right);
+            if (ux < p_left) {
+                ux = std::fmin(ux / p_left, 1 - 0x1p-53);
+                current = current + 1;
+            } else {
+                ux = std::fmin((ux - p_left) / (1 - p_left), 1 - 0x1p-53);
+                current = node.offset;
+            }
+        }
+    }
+
+    size_t size() const {
+        return lights.size();
+    }
+
+private:
+    std::vector<shared_ptr<hittable>> lights; // in leaf order
+    std::vector<light_bounds> bounds;         // per light, in leaf order
+    std::vector<light_bounds> node_bounds;    // per tree node
+    std::vector<uint32_t> parents;            // per tree node; the root's is unused
+    std::vector<uint32_t> leaves;             // per light, the leaf holding it
+    linear_bvh tree;
+    aabb bbox;
+
+    // Fills in node_bounds, parents and leaves for the subtree at index.
+    light_bounds build_node_bounds(uint32_t index, uint32_t parent) {
+        const auto &node = tree.nodes[index];
+        parents[index] = parent;
+
+        light_bounds b;
+        if (node.prim_count > 0) {
+            b = bounds[node.offset];
+            leaves[node.offset] = index;
+            for (uint32_t i = 1; i < node.prim_count; i++) {
+                b = merge(b, bounds[node.offset + i]);
+                leaves[node.offset + i] = index;
+            }
+        } else {
+            auto left = build_node_bounds(index + 1, index);
+            auto right = build_node_bounds(node.offset, index);
+            b = merge(left, right);
+        }
+
+        node_bounds[index] = b;
+        return b;
+    }
+
+    // The probability that random() picks light index from origin: the
+    // chance of choosing it within its leaf, times that of each choice on
+    // the way down to the leaf.
+    double pick_probability(const point3 &origin, uint32_t index) const {
+        uint32_t current = leaves[index];
+        const auto &leaf = tree.nodes[current];
+
+        double total = 0;
+        for (uint32_t i = 0; i < leaf.prim_count; i++)
+            total += importance(origin, bounds[leaf.offset + i]);
+        if (total <= 0)
+            return 0;
+        double p = importance(origin, bounds[index]) / total;
+
+        while (current != 0 && p > 0) {
+            uint32_t parent = parents[current];
+            auto left = importance(origin, node_bounds[parent + 1]);
+            auto right = importance(origin, node_bounds[tree.nodes[parent].offset]);
+            p *= (current == parent + 1 ? left : right) / (left + right);
+            current = parent;
+        }
+        return p;
+    }
+
+    // A conservative estimate of the power that lights within b send to p:
+    // their total power, over the squared distance, times the cosine of the
+    // smallest angle any of their normals could make with the direction to p.
+    static double importance(const point3 &p, const light_bounds &b) {
+        if (b.phi <= 0)
+            return 0;
+
+        point3 lo(b.bounds.x.min, b.bounds.y.min, b.bounds.z.min);
+        point3 hi(b.bounds.x.max, b.bounds.y.max, b.bounds.z.max);
+        point3 center = 0.5 * (lo + hi);
+        auto radius = 0.5 * (hi - lo).length();
+
+        // Keep the falloff finite for points close to or inside the bounds.
+        auto distance_squared = std::fmax((p - center).length_squared(), radius * radius);
+
+        // Angle between w and the direction from the bounds to p.
+        vec3 wi = p - center;
+        auto wi_length = wi.length();
+        double cos_theta_w = wi_length > 0 ? dot(b.w, wi) / wi_length : 1;
+        if (b.two_sided)
+            cos_theta_w = std::fabs(cos_theta_w);
+        auto sin_theta_w = safe_sqrt(1 - cos_theta_w * cos_theta_w);
+
+        // Half-angle of the cone that the bounds subtend from p.
+        double cos_theta_b = -1;
+        if ((p - center).length_squared() > radius * radius)
+            cos_theta_b = safe_sqrt(1 - radius * radius / (p - center).length_squared());
+        auto sin_theta_b = safe_sqrt(1 - cos_theta_b * cos_theta_b);
+
+        // Shrink the angle to p by the normal cone, then by the subtended cone.
+        auto sin_theta_o = safe_sqrt(1 - b.cos_theta_o * b.cos_theta_o);
+        auto cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, b.cos_theta_o);
+        auto sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, b.cos_theta_o);
+        auto cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+        if (cos_theta_p <= b.cos_theta_e)
+            return 0;
+
+        return std::fmax(b.phi * cos_theta_p / distance_squared, 0.0);
+    }
+
+    // cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines
+    // of a and b.
+    static double cos_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        if (cos_a > cos_b)
+            return 1;
+        return cos_a * cos_b + sin_a * sin_b;
+    }
+
+    static double sin_sub_clamped(double sin_a, double cos_a, double sin_b, double cos_b) {
+        if (cos_a > cos_b)
+            return 0;
+        return sin_a * cos_b - cos_a * sin_b;
+    }
+
+    static double safe_sqrt(double x) {
+        return std::sqrt(std::fmax(x, 0.0));
+    }
+
+    static light_bounds merge(const light_bounds &a, const light_bounds &b) {
+        if (a.phi <= 0)
+            return b;
+        if (b.phi <= 0)
+            return a;
+
+        light_bounds result;
+        result.bounds = aabb(a.bounds, b.bounds);
+        result.phi = a.phi + b.phi;
+        result.cos_theta_e = std::fmin(a.cos_theta_e, b.cos_theta_e);
+        result.two_sided = a.two_sided || b.two_sided;
+        merge_cones(a.w, a.cos_theta_o, b.w, b.cos_theta_o, result.w, result.cos_theta_o);
+        return result;
+    }
+
+    // The smallest cone containing cones (wa, cos_a) and (wb, cos_b).
+    static void merge_cones(const vec3 &wa, double cos_a, const vec3 &wb, double cos_b,
+                            vec3 &w, double &cos_theta) {
+        auto theta_a = std::acos(std::clamp(cos_a, -1.0, 1.0));
+        auto theta_b = std::acos(std::clamp(cos_b, -1.0, 1.0));
+        auto theta_d = std::acos(std::clamp(dot(wa, wb), -1.0, 1.0));
+
+        if (std::fmin(theta_d + theta_b, pi) <= theta_a) {
+            w = wa;
+            cos_theta = cos_a;
+            return;
+        }
+        if (std::fmin(theta_d + theta_a, pi) <= theta_b) {
+            w = wb;
+            cos_theta = cos_b;
+            return;
+        }
+
+        auto theta_o = (theta_a + theta_d + theta_b) / 2;
+        vec3 axis = cross(wa, wb);
+        if (theta_o >= pi || axis.length_squared() == 0) {
+            w = wa;
+            cos_theta = -1;
+            return;
+        }
+
+        // Rotate wa towards wb by theta_o - theta_a (Rodrigues' formula).
+        auto theta_r = theta_o - theta_a;
+        axis = unit_vector(axis);
+        w = wa * std::cos(theta_r) + cross(axis, wa) * std::sin(theta_r)
+          + axis * dot(axis, wa) * (1 - std::cos(theta_r));
+        cos_theta = std::cos(theta_o);
+    }
+};
@@ -2,15 +2,32 @@
 
 #include "util.h"
 
+#include "hittable.h"
 #include "pdf.h"
 #include "texture.h"
 
-class hit_record;
+#include <typeinfo>
+
+// A material as plain data, for scene files. texture indexes the scene's
+// texture table; albedo and parameter (a metal's fuzz, a dielectric's
+// refraction index) are used by the kinds that take them.
+struct material_record {
+	enum : uint32_t { plain = 0, lambertian = 1, metal = 2, dielectric = 3, diffuse_light = 4, isotropic = 5 };
+
+	uint32_t kind;
+	uint32_t texture;
+	double parameter;
+	color albedo;
+
+	bool textured() const {
+		return kind == lambertian || kind == diffuse_light || kind == isotropic;
+	}
+};
 
 class scatter_record {
 public:
 	color attenuation;
-	shared_ptr<pdf> pdf_ptr;
+	scatter_pdf pdf;
 	bool skip_pdf;
 	ray skip_pdf_ray;
 };
@@ -25,8 +42,17 @@ public:
 		return color(0, 0, 0);
 	}
 
+	// The radiance this material typically emits, for weighting lights by
+	// their power.
+	virtual color mean_emission() const {
+		return color(0, 0, 0);
+	}
+
+	// uc and u (in [0, 1)^2 as u.x() and u.y()) are sample values for
+	// materials that choose their scattered ray themselves. Those that set
+	// srec.pdf instead leave them unused, and the caller samples the pdf.
 	virtual bool scatter(
-		const ray &r_in, const hit_record &rec, scatter_record &srec
+		const ray &r_in, const hit_record &rec, scatter_record &srec, double uc, const vec3 &u
 	) const {
 		return false;
 	}
@@ -36,6 +62,14 @@ public:
 	) const {
 		return 0;
 	}
+
+	// Describes this material as plain data, adding the textures it uses to
+	// textures. Materials with no plain-data form return false. A plain
+	// material, which neither scatters nor emits, is one of its own.
+	virtual bool encode(material_record &record, std::vector<texture_record> &textures) const {
+		record = { material_record::plain, 0, 0, color(0, 0, 0) };
+		return typeid(*this) == typeid(material);
+	}
 };
 
 class lambertian : public material {
@@ -44,10 +78,10 @@ public:
 	lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
 	bool scatter(
-		const ray &r_in, const hit_record &rec, scatter_record &srec
+		const ray &r_in, const hit_record &rec, scatter_record &srec, double uc, const vec3 &u
 	) const override {
 		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-		srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+		srec.pdf = cosine_pdf(rec.normal);
 		srec.skip_pdf = false;
 		return true;
 	}
@@ -55,10 +89,19 @@ public:
 	double scattering_pdf(
 		const ray &r_in, const hit_record &rec, const ray &scattered
 	) const override {
+		return cosine_scattering_pdf(rec, scattered);
+	}
+
+	static double cosine_scattering_pdf(const hit_record &rec, const ray &scattered) {
 		auto cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
 		return cos_theta < 0 ? 0 : cos_theta / pi;
 	}
 
+	bool encode(material_record &record, std::vector<texture_record> &textures) const override {
+		record = { material_record::lambertian, 0, 0, color(0, 0, 0) };
+		return tex->encode(textures, record.texture);
+	}
+
 private:
 	shared_ptr<texture> tex;
 };
@@ -68,19 +111,28 @@ public:
 	metal(const color &albedo, double fuzz) : albedo(albedo), fuzz(fuzz < 1 ? fuzz : 1) {}
 
 	bool scatter(
-		const ray &r_in, const hit_record &rec, scatter_record &srec
+		const ray &r_in, const hit_record &rec, scatter_record &srec, double uc, const vec3 &u
 	) const override {
+		return scatter(albedo, fuzz, r_in, rec, srec, u);
+	}
+
+	static bool scatter(const color &albedo, double fuzz, const ray &r_in, const hit_record &rec,
+	                    scatter_record &srec, const vec3 &u) {
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		reflected = unit_vector(reflected) + fuzz * random_unit_vector();
+		reflected = unit_vector(reflected) + fuzz * sample_unit_vector(u);
 
 		srec.attenuation = albedo;
-		srec.pdf_ptr = nullptr;
 		srec.skip_pdf = true;
 		srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
 
 		return true;
 	}
 
+	bool encode(material_record &record, std::vector<texture_record> &textures) const override {
+		record = { material_record::metal, 0, fuzz, albedo };
+		return true;
+	}
+
 private:
 	color albedo;
 	double fuzz;
@@ -91,10 +143,14 @@ public:
 	dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
 	bool scatter(
-		const ray &r_in, const hit_record &rec, scatter_record &srec
+		const ray &r_in, const hit_record &rec, scatter_record &srec, double uc, const vec3 &u
 	) const override {
+		return scatter(refraction_index, r_in, rec, srec, uc);
+	}
+
+	static bool scatter(double refraction_index, const ray &r_in, const hit_record &rec, scatter_record &srec,
+	                    double uc) {
 		srec.attenuation = color(1.0, 1.0, 1.0);
-		srec.pdf_ptr = nullptr;
 		srec.skip_pdf = true;
 		double ri = rec.front_face ? (1 / refraction_index) : refraction_index;
 
@@ -105,7 +161,7 @@ public:
 		bool cannot_refract = ri * sin_theta > 1.0;
 		vec3 direction;
 
-		if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+		if (cannot_refract || reflectance(cos_theta, ri) > uc)
 			direction = reflect(unit_direction, rec.normal);
 		else
 			direction = refract(unit_direction, rec.normal, ri);
@@ -114,6 +170,11 @@ public:
 		return true;
 	}
 
+	bool encode(material_record &record, std::vector<texture_record> &textures) const override {
+		record = { material_record::dielectric, 0, refraction_index, color(0, 0, 0) };
+		return true;
+	}
+
 private:
 	double refraction_index;
 
@@ -136,6 +197,15 @@ public:
 		return tex->value(u, v, p);
 	}
 
+	color mean_emission() const override {
+		return tex->value(0.5, 0.5, point3(0, 0, 0));
+	}
+
+	bool encode(material_record &record, std::vector<texture_record> &textures) const override {
+		record = { material_record::diffuse_light, 0, 0, color(0, 0, 0) };
+		return tex->encode(textures, record.texture);
+	}
+
 private:
 	shared_ptr<texture> tex;
 };
@@ -146,10 +216,10 @@ public:
 	isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
 	bool scatter(
-		const ray &r_in, const hit_record &rec, scatter_record &srec
+		const ray &r_in, const hit_record &rec, scatter_record &srec, double uc, const vec3 &u
 	) const override {
 		srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-		srec.pdf_ptr = make_shared<sphere_pdf>();
+		srec.pdf = sphere_pdf();
 		srec.skip_pdf = false;
 		return true;
 	}
@@ -159,6 +229,85 @@ public:
 		return 1 / (4 * pi);
 	}
 
+	bool encode(material_record &record, std::vector<texture_record> &textures) const override {
+		record = { material_record::isotropic, 0, 0, color(0, 0, 0) };
+		return tex->encode(textures, record.texture);
+	}
+
 private:
 	shared_ptr<texture> tex;
 };
+
+// Rebuilds a material from its record, with its texture taken from the
+// decoded texture table.
+inline shared_ptr<material> decode_material(const material_record &record,
+                                            const std::vector<shared_ptr<texture>> &textures) {
+	switch (record.kind) {
+	case material_record::lambertian:
+		return make_shared<lambertian>(textures[record.texture]);
+	case material_record::metal:
+		return make_shared<metal>(record.albedo, record.parameter);
+	case material_record::dielectric:
+		return make_shared<dielectric>(record.parameter);
+	case material_record::diffuse_light:
+		return make_shared<diffuse_light>(textures[record.texture]);
+	case material_record::isotropic:
+		return make_shared<isotropic>(textures[record.texture]);
+	default:
+		return make_shared<material>();
+	}
+}
+
+// The emission, scattering and scattering pdf of the material at a hit. It
+// is either an object, for materials with no plain-data form, or a record
+// from a compiled scene's table, whose texture indices address rec.textures.
+// A record shades exactly as the material decode_material rebuilds from it.
+
+inline color shade_emitted(const ray &r_in, const hit_record &rec) {
+	if (rec.mat)
+		return rec.mat->emitted(r_in, rec, rec.u, rec.v, rec.p);
+
+	const auto &m = *rec.mat_record;
+	if (m.kind != material_record::diffuse_light || !rec.front_face)
+		return color(0, 0, 0);
+	return texture_value(rec.textures, m.texture, rec.u, rec.v, rec.p);
+}
+
+inline bool shade_scatter(const ray &r_in, const hit_record &rec, scatter_record &srec, double uc, const vec3 &u) {
+	if (rec.mat)
+		return rec.mat->scatter(r_in, rec, srec, uc, u);
+
+	const auto &m = *rec.mat_record;
+	switch (m.kind) {
+	case material_record::lambertian:
+		srec.attenuation = texture_value(rec.textures, m.texture, rec.u, rec.v, rec.p);
+		srec.pdf = cosine_pdf(rec.normal);
+		srec.skip_pdf = false;
+		return true;
+	case material_record::metal:
+		return metal::scatter(m.albedo, m.parameter, r_in, rec, srec, u);
+	case material_record::dielectric:
+		return dielectric::scatter(m.parameter, r_in, rec, srec, uc);
+	case material_record::isotropic:
+		srec.attenuation = texture_value(rec.textures, m.texture, rec.u, rec.v, rec.p);
+		srec.pdf = sphere_pdf();
+		srec.skip_pdf = false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+inline double shade_scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) {
+	if (rec.mat)
+		return rec.mat->scattering_pdf(r_in, rec, scattered);
+
+	switch (rec.mat_record->kind) {
+	case material_record::lambertian:
+		return lambertian::cosine_scattering_pdf(rec, scattered);
+	case material_record::isotropic:
+		return 1 / (4 * pi);
+	default:
+		return 0;
+	}
+}
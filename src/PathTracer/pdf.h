@@ -2,84 +2,69 @@
 
 #include "util.h"
 
-#include "hittable_list.h"
 #include "onb.h"
 
-class pdf {
-public:
-    virtual ~pdf() {}
+#include <variant>
 
-    virtual double value(const vec3 &direction) const = 0;
-    virtual vec3 generate() const = 0;
-};
+// PDFs are small value types with value() and generate(). They live on the
+// stack for the duration of one bounce, so sampling a path never allocates.
+// generate() maps a 2D sample u, in [0, 1)^2 as u.x() and u.y(), to a
+// direction, so a low-discrepancy sampler can drive it.
 
-class sphere_pdf : public pdf {
+class sphere_pdf {
 public:
     sphere_pdf() {}
 
-    double value(const vec3 &direction) const override {
+    double value(const vec3 &direction) const {
         return 1 / (4 * pi);
     }
 
-    vec3 generate() const override {
-        return random_unit_vector();
+    vec3 generate(const vec3 &u) const {
+        return sample_unit_vector(u);
     }
 };
 
-class cosine_pdf : public pdf {
+class cosine_pdf {
 public:
     cosine_pdf(const vec3 &w) : uvw(w) {}
 
-    double value(const vec3 &direction) const override {
+    double value(const vec3 &direction) const {
         auto cosine_theta = dot(unit_vector(direction), uvw.w());
         return std::fmax(0, cosine_theta / pi);
     }
 
-    vec3 generate() const override {
-        return uvw.transform(random_cosine_direction());
+    vec3 generate(const vec3 &u) const {
+        return uvw.transform(sample_cosine_direction(u));
     }
 
 private:
     onb uvw;
 };
 
-class hittable_pdf : public pdf {
+// Any of the distributions a material can hand back from scatter().
+class scatter_pdf {
 public:
-    hittable_pdf(const hittable &objects, const point3 &origin)
-        : objects(objects), origin(origin)
-    {}
-
-    double value(const vec3 &direction) const override {
-        return objects.pdf_value(origin, direction);
-    }
-
-    vec3 generate() const override {
-        return objects.random(origin);
-    }
+    scatter_pdf() {}
 
-private:
-    const hittable &objects;
-    point3 origin;
-};
-
-class mixture_pdf : public pdf {
-public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-        p[0] = p0;
-        p[1] = p1;
-    }
+    template <typename T>
+    scatter_pdf(const T &pdf) : p(pdf) {}
 
-    double value(const vec3 &direction) const override {
-        return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
+    double value(const vec3 &direction) const {
+        return std::visit([&](const auto &pdf) { return pdf.value(direction); }, p);
     }
 
-    vec3 generate() const override {
-        if (random_double() < 0.5)
-            return p[0]->generate();
-        else
-            return p[1]->generate();
+    vec3 generate(const vec3 &u) const {
+        return std::visit([&](const auto &pdf) { return pdf.generate(u); }, p);
     }
 
 private:
-    shared_ptr<pdf> p[2];
+    std::variant<sphere_pdf, cosine_pdf> p;
 };
+
+// The power heuristic (beta = 2) weight for a sample drawn from a strategy
+// with density f_pdf, when another strategy would have drawn it with g_pdf.
+inline double power_heuristic(double f_pdf, double g_pdf) {
+    auto f = f_pdf * f_pdf;
+    auto g = g_pdf * g_pdf;
+    return f / (f + g);
+}
@@ -4,6 +4,9 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
+
+#include <typeinfo>
 
 class quad : public hittable {
 public:
@@ -11,23 +14,13 @@ public:
     vec3 u, v;
 
     quad(const point3 &Q, const vec3 &u, const vec3 &v, shared_ptr<material> mat)
-        : Q(Q), u(u), v(v), mat(mat)
+        : Q(Q), u(u), v(v), mat(mat), geometry(quad_data::make(Q, u, v, 0))
     {
-		auto n = cross(u, v);
-		normal = unit_vector(n);
-        D = dot(normal, Q);
-		w = n / dot(n, n);
-
-        area = n.length();
-
         set_bounding_box();
     }
 
     virtual void set_bounding_box() {
-        // Compute the bounding box of all four vertices.
-        auto bbox_diagonal1 = aabb(Q, Q + u + v);
-        auto bbox_diagonal2 = aabb(Q + u, Q + v);
-        bbox = aabb(bbox_diagonal1, bbox_diagonal2);
+        bbox = geometry.bounding_box();
     }
 
     aabb bounding_box() const override {
@@ -35,31 +28,30 @@ public:
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-		auto denom = dot(normal, r.direction());
-
-        if (std::fabs(denom) < 1e-8)
+        double t, alpha, beta;
+        if (!geometry.hit_plane(r, ray_t, t, alpha, beta))
             return false;
 
-		auto t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
-            return false;
-
-		auto intersection = r.at(t);
-		vec3 planar_hitpt_vector = intersection - Q;
-        auto alpha = dot(w, cross(planar_hitpt_vector, v));
-		auto beta = dot(w, cross(u, planar_hitpt_vector));
-
         if (!is_interior(alpha, beta, rec))
 			return false;
 
         rec.t = t;
-		rec.p = intersection;
-        rec.mat = mat;
-		rec.set_face_normal(r, normal);
+		rec.p = r.at(t);
+        rec.set_material(mat.get());
+		rec.set_face_normal(r, geometry.normal);
 
 		return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override {
+        double t, alpha, beta;
+        if (!geometry.hit_plane(r, ray_t, t, alpha, beta))
+            return false;
+
+        hit_record rec; // is_interior() may set texture coordinates
+        return is_interior(alpha, beta, rec);
+    }
+
 	virtual bool is_interior(double a, double b, hit_record &rec) const {
 		interval unit_interval = interval(0, 1);
 
@@ -79,21 +71,39 @@ public:
         auto distance_squared = rec.t * rec.t * direction.length_squared();
         auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
 
-        return distance_squared / (cosine * area);
+        return distance_squared / (cosine * geometry.area);
     }
 
-    vec3 random(const point3 &origin) const override {
-        auto p = Q + (random_double() * u) + (random_double() * v);
+    light_bounds bounds_as_light() const override {
+        // One-sided, so the normals are all exactly geometry.normal.
+        light_bounds b;
+        b.bounds = bbox;
+        b.w = geometry.normal;
+        b.phi = mat ? luminance(mat->mean_emission()) * geometry.area * pi : 0;
+        b.cos_theta_o = 1;
+        return b;
+    }
+
+    vec3 random(const point3 &origin, const vec3 &sample) const override {
+        auto p = Q + (sample.x() * u) + (sample.y() * v);
         return p - origin;
     }
 
+    bool compile(scene_builder &builder) const override {
+        // Subclasses with their own is_interior() can't use the plain quad test.
+        if (typeid(*this) != typeid(quad))
+            return false;
+
+        auto q = geometry;
+        q.material = builder.add_material(mat);
+        builder.add(q);
+        return true;
+    }
+
 private:
-    vec3 w;
     shared_ptr<material> mat;
+    quad_data geometry;
     aabb bbox;
-    vec3 normal;
-    double D;
-    double area;
 };
 
 inline shared_ptr<hittable_list> box(const point3 &a, const point3 &b, shared_ptr<material> mat) {
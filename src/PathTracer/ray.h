@@ -7,7 +7,12 @@ public:
 	ray() {}
 
 	ray(const point3 &origin, const vec3 &direction, double time)
-		: orig(origin), dir(direction), tm(time) {}
+		: orig(origin), dir(direction), tm(time)
+	{
+		inv_dir = vec3(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+		for (int axis = 0; axis < 3; axis++)
+			sign[axis] = std::signbit(inv_dir[axis]) ? 1 : 0;
+	}
 
 	ray(const point3 &origin, const vec3 &direction)
 		: ray(origin, direction, 0) {}
@@ -17,6 +22,12 @@ public:
 
 	double time() const { return tm; }
 
+	// 1 / direction per axis, infinite along axes the ray runs parallel to,
+	// and whether each component is negative. Box tests reuse these for
+	// every node a ray visits instead of dividing again.
+	const vec3 &inv_direction() const { return inv_dir; }
+	int direction_sign(int axis) const { return sign[axis]; }
+
 	point3 at(double t) const {
 		return orig + t * dir;
 	}
@@ -25,4 +36,6 @@ private:
 	point3 orig;
 	vec3 dir;
 	double tm;
+	vec3 inv_dir;
+	int sign[3];
 };
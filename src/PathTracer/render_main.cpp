@@ -0,0 +1,209 @@
+// Renders one frame on the CPU, whole or as one worker's share of it, and
+// merges the shares of a split frame.
+//
+// Usage: PathTracerRender render (--scene NAME | --gltf FILE | --scene-file FILE)
+//                                [--width N] [--spp N] [--seed N] [--threads N]
+//                                [--sampler independent|halton|sobol] [--adaptive ERROR]
+//                                [--pass-samples N] [--checkpoint FILE] [--checkpoint-interval SECONDS]
+//                                [--split tiles|samples --worker W --workers N] [--output FILE]
+//        PathTracerRender merge --output FILE PARTIAL...
+//
+// --width and --spp default to the scene's own. The image is written as
+// PFM, OpenEXR or PNG, by the extension of --output. With --checkpoint the
+// render saves its progress and picks up from it after being stopped; it
+// then takes samples in passes of 16 per pixel unless --pass-samples says
+// otherwise.
+//
+// With --split, each of the workers runs render with the same options, on
+// one machine or several, and writes its share to its --checkpoint file
+// rather than an image. merge then combines these into the image one
+// render with the same --pass-samples would have made, bit for bit; for a
+// samples split, as long as that divides spp / workers.
+
+#include "gltf_loader.h"
+#include "scene_file.h"
+#include "scenes.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct render_options {
+    std::string scene;
+    std::string gltf;
+    std::string scene_file;
+    int width = 0; // 0 keeps the scene's
+    int spp = 0;   // likewise
+    uint64_t seed = 1;
+    int threads = 0;
+    std::string sampler = "sobol";
+    double adaptive_error = 0; // 0 samples every pixel fully
+    int pass_samples = 0;
+    std::string checkpoint;
+    double checkpoint_interval = 300;
+    std::string split = "none";
+    int worker = 0;
+    int workers = 1;
+    std::string output = "output.png";
+    std::vector<std::string> partials; // for merge
+};
+
+static bool parse_args(int argc, char **argv, render_options &options) {
+    for (int i = 2; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (!std::strcmp(argv[i], "--scene") && has_value)
+            options.scene = argv[++i];
+        else if (!std::strcmp(argv[i], "--gltf") && has_value)
+            options.gltf = argv[++i];
+        else if (!std::strcmp(argv[i], "--scene-file") && has_value)
+            options.scene_file = argv[++i];
+        else if (!std::strcmp(argv[i], "--width") && has_value)
+            options.width = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--spp") && has_value)
+            options.spp = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--seed") && has_value)
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (!std::strcmp(argv[i], "--threads") && has_value)
+            options.threads = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--sampler") && has_value)
+            options.sampler = argv[++i];
+        else if (!std::strcmp(argv[i], "--adaptive") && has_value)
+            options.adaptive_error = std::atof(argv[++i]);
+        else if (!std::strcmp(argv[i], "--pass-samples") && has_value)
+            options.pass_samples = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--checkpoint") && has_value)
+            options.checkpoint = argv[++i];
+        else if (!std::strcmp(argv[i], "--checkpoint-interval") && has_value)
+            options.checkpoint_interval = std::atof(argv[++i]);
+        else if (!std::strcmp(argv[i], "--split") && has_value)
+            options.split = argv[++i];
+        else if (!std::strcmp(argv[i], "--worker") && has_value)
+            options.worker = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--workers") && has_value)
+            options.workers = std::atoi(argv[++i]);
+        else if (!std::strcmp(argv[i], "--output") && has_value)
+            options.output = argv[++i];
+        else if (argv[i][0] != '-')
+            options.partials.push_back(argv[i]);
+        else
+            return false;
+    }
+    return (options.sampler == "independent" || options.sampler == "halton" || options.sampler == "sobol")
+        && (options.split == "none" || options.split == "tiles" || options.split == "samples");
+}
+
+static sampler_type parse_sampler(const std::string &name) {
+    if (name == "independent")
+        return sampler_type::independent;
+    if (name == "halton")
+        return sampler_type::halton;
+    return sampler_type::sobol;
+}
+
+static frame_split parse_split(const std::string &name) {
+    if (name == "tiles")
+        return frame_split::tiles;
+    if (name == "samples")
+        return frame_split::samples;
+    return frame_split::none;
+}
+
+static void configure_camera(camera &cam, const render_options &options) {
+    if (options.width > 0)
+        cam.image_width = options.width;
+    if (options.spp > 0)
+        cam.samples_per_pixel = options.spp;
+    cam.seed = options.seed;
+    cam.thread_count = options.threads;
+    cam.pixel_sampler = parse_sampler(options.sampler);
+    cam.adaptive = options.adaptive_error > 0;
+    cam.adaptive_error = options.adaptive_error;
+    cam.pass_samples = options.pass_samples;
+    cam.checkpoint_filename = options.checkpoint;
+    cam.checkpoint_interval = options.checkpoint_interval;
+    cam.split = parse_split(options.split);
+    cam.worker_index = options.worker;
+    cam.worker_count = options.workers;
+
+    // A worker's share lives in its checkpoint until merged.
+    cam.output_filename = cam.split == frame_split::none ? options.output : "";
+}
+
+static bool render(const render_options &options) {
+    if (options.split != "none" && options.checkpoint.empty()) {
+        std::cerr << "--split needs a --checkpoint file to write the share to\n";
+        return false;
+    }
+
+    if (!options.scene_file.empty()) {
+        scene_file file;
+        if (!file.open(options.scene_file))
+            return false;
+
+        camera cam;
+        file.apply_camera(cam);
+        configure_camera(cam, options);
+        return cam.render(file.world(), file.lights());
+    }
+
+    // Scene setup draws random numbers too; every worker must build the
+    // same scene.
+    seed_random(options.seed, 0);
+
+    scene_setup scene;
+    if (!options.gltf.empty()) {
+        if (!load_gltf(options.gltf, scene))
+            return false;
+    } else {
+        auto entry = std::find_if(std::begin(builtin_scenes), std::end(builtin_scenes),
+                                  [&](const named_scene &s) { return options.scene == s.name; });
+        if (entry == std::end(builtin_scenes)) {
+            std::cerr << "Unknown scene: " << options.scene << "\n";
+            return false;
+        }
+        scene = entry->make();
+    }
+
+    configure_camera(scene.cam, options);
+    return scene.cam.render(scene.world, scene.lights);
+}
+
+static bool merge(const render_options &options) {
+    std::vector<render_checkpoint> partials(options.partials.size());
+    for (size_t i = 0; i < partials.size(); i++) {
+        if (!read_checkpoint(options.partials[i], partials[i])) {
+            std::cerr << "Could not read " << options.partials[i] << "\n";
+            return false;
+        }
+    }
+
+    film image;
+    if (!merge_partials(partials, image))
+        return false;
+
+    if (!write_film(image, options.output)) {
+        std::cerr << "Could not write " << options.output << "\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    render_options options;
+    std::string command = argc > 1 ? argv[1] : "";
+    bool parsed = parse_args(argc, argv, options);
+    if ((command != "render" && command != "merge") || !parsed || (command == "render") != options.partials.empty()) {
+        std::cerr << "Usage: " << argv[0] << " render (--scene NAME | --gltf FILE | --scene-file FILE)"
+                  << " [--width N] [--spp N] [--seed N] [--threads N] [--sampler independent|halton|sobol]"
+                  << " [--adaptive ERROR] [--pass-samples N] [--checkpoint FILE] [--checkpoint-interval SECONDS]"
+                  << " [--split tiles|samples --worker W --workers N] [--output FILE]\n"
+                  << "       " << argv[0] << " merge --output FILE PARTIAL...\n";
+        return 1;
+    }
+
+    if (command == "render")
+        return render(options) ? 0 : 1;
+    return merge(options) ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include "util.h"
+
+#include <memory>
+#include <vector>
+
+// Supplies the sample values for one camera path at a time. A path asks for
+// its dimensions in a fixed order: pixel position, lens position and time,
+// then a fixed set per bounce. A low-discrepancy sampler spreads each of
+// those dimensions evenly over a pixel's samples. Any number of samples per
+// pixel works, and so does extending a pixel with further samples later.
+class sampler {
+public:
+    virtual ~sampler() = default;
+
+    // Starts sample sample_index of pixel (x, y) from dimension 0.
+    virtual void start_pixel_sample(int x, int y, uint32_t sample_index) = 0;
+
+    // Returns one value in [0, 1).
+    virtual double get_1d() = 0;
+
+    // Returns two values in [0, 1) as x and y, with z set to 0.
+    virtual vec3 get_2d() = 0;
+};
+
+enum class sampler_type {
+    independent,
+    halton,
+    sobol,
+};
+
+namespace sampling {
+
+inline uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Burley's variant of the Laine-Karras hash: each output bit depends only on
+// the input bits below it, and flips pseudo-randomly with the seed.
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return x;
+}
+
+// An Owen scramble of a fixed-point value in [0, 1), with the most
+// significant bit as the first digit.
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+// The first two dimensions of the Sobol sequence, as 32-bit fractions.
+inline uint32_t sobol_0(uint32_t index) {
+    return reverse_bits(index);
+}
+
+inline uint32_t sobol_1(uint32_t index) {
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+inline double to_unit(uint32_t x) {
+    return x * 0x1p-32;
+}
+
+inline uint64_t pixel_hash(uint64_t seed, int x, int y) {
+    return mix_bits(seed + mix_bits((static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) | static_cast<uint32_t>(x)));
+}
+
+inline uint32_t dimension_hash(uint64_t pixel, uint32_t dimension) {
+    return static_cast<uint32_t>(mix_bits(pixel ^ (0x9e3779b97f4a7c15ULL * (dimension + 1))));
+}
+
+inline const std::vector<uint32_t> &primes() {
+    static const std::vector<uint32_t> table = [] {
+        std::vector<uint32_t> p;
+        for (uint32_t n = 2; p.size() < 256; n++) {
+            bool is_prime = true;
+            for (auto q : p) {
+                if (q * q > n)
+                    break;
+                if (n % q == 0) {
+                    is_prime = false;
+                    break;
+                }
+            }
+            if (is_prime)
+                p.push_back(n);
+        }
+        return p;
+    }();
+    return table;
+}
+
+// Element i of a pseudo-random permutation of [0, l) picked by p (Kensler,
+// "Correlated Multi-Jittered Sampling", 2013).
+inline uint32_t permutation_element(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// The radical inverse of index in the given base, Owen scrambled: each digit
+// goes through a random permutation picked by a hash of the digits before
+// it. Past the last nonzero digit of index, the remaining digits are
+// scrambled zeros, which amounts to a uniform value picked by the hash of
+// the prefix.
+inline double owen_scrambled_radical_inverse(uint32_t base, uint64_t index, uint64_t seed) {
+    double inv_base = 1.0 / base;
+    double inv_base_n = 1.0;
+    uint64_t reversed = 0;
+    while (index) {
+        uint64_t next = index / base;
+        auto digit = static_cast<uint32_t>(index - next * base);
+        auto digit_hash = static_cast<uint32_t>(mix_bits(seed ^ (reversed * 0x9e3779b97f4a7c15ULL)));
+        reversed = reversed * base + permutation_element(digit, base, digit_hash);
+        inv_base_n *= inv_base;
+        index = next;
+    }
+
+    auto tail = to_unit(static_cast<uint32_t>(mix_bits(seed ^ (reversed * 0x9e3779b97f4a7c15ULL) ^ 0x5bd1e995)));
+    return std::fmin((reversed + tail) * inv_base_n, 1 - 0x1p-53);
+}
+
+} // namespace sampling
+
+// Uncorrelated uniform samples, seeded per pixel and sample index.
+class independent_sampler : public sampler {
+public:
+    explicit independent_sampler(uint64_t seed) : seed(seed) {}
+
+    void start_pixel_sample(int x, int y, uint32_t sample_index) override {
+        rng.seed(sampling::pixel_hash(seed, x, y), sample_index);
+    }
+
+    double get_1d() override {
+        return rng.next_double();
+    }
+
+    vec3 get_2d() override {
+        auto u = rng.next_double();
+        return vec3(u, rng.next_double(), 0);
+    }
+
+private:
+    uint64_t seed;
+    pcg32 rng;
+};
+
+// The Halton sequence, one prime base per dimension, Owen scrambled with a
+// different seed per pixel and dimension. The scrambling both decorrelates
+// pixels and breaks up the patterns that make plain Halton dimensions with
+// large neighbouring bases correlated. Dimensions past the prime table fall
+// back to independent samples.
+class halton_sampler : public sampler {
+public:
+    explicit halton_sampler(uint64_t seed) : seed(seed) {}
+
+    void start_pixel_sample(int x, int y, uint32_t sample_index) override {
+        pixel = sampling::pixel_hash(seed, x, y);
+        index = sample_index;
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        return sample(dimension++);
+    }
+
+    vec3 get_2d() override {
+        auto u = sample(dimension++);
+        return vec3(u, sample(dimension++), 0);
+    }
+
+private:
+    uint64_t seed;
+    uint64_t pixel = 0;
+    uint32_t index = 0;
+    uint32_t dimension = 0;
+
+    double sample(uint32_t dim) const {
+        const auto &primes = sampling::primes();
+        if (dim >= primes.size())
+            return sampling::to_unit(sampling::dimension_hash(pixel ^ mix_bits(index), dim));
+
+        return sampling::owen_scrambled_radical_inverse(primes[dim], index, mix_bits(pixel + dim));
+    }
+};
+
+// Owen-scrambled Sobol points, after Burley, "Practical Hash-based Owen
+// Scrambling" (2020). Every get_1d or get_2d call is its own padded block:
+// the sample index is shuffled by a hashed Owen scramble of its own, and the
+// first one or two Sobol dimensions at that index are Owen-scrambled with a
+// hash of the pixel and dimension. Each block keeps the stratification of
+// the Sobol (0, 2)-sequence at every power-of-two prefix, and blocks are
+// decorrelated from each other and between pixels.
+class sobol_sampler : public sampler {
+public:
+    explicit sobol_sampler(uint64_t seed) : seed(seed) {}
+
+    void start_pixel_sample(int x, int y, uint32_t sample_index) override {
+        pixel = sampling::pixel_hash(seed, x, y);
+        index = sample_index;
+        dimension = 0;
+    }
+
+    double get_1d() override {
+        auto hash = sampling::dimension_hash(pixel, dimension++);
+        auto i = sampling::nested_uniform_scramble(index, hash);
+        return sampling::to_unit(sampling::nested_uniform_scramble(sampling::sobol_0(i), mix_hash(hash, 1)));
+    }
+
+    vec3 get_2d() override {
+        auto hash = sampling::dimension_hash(pixel, dimension++);
+        auto i = sampling::nested_uniform_scramble(index, hash);
+        auto u = sampling::nested_uniform_scramble(sampling::sobol_0(i), mix_hash(hash, 1));
+        auto v = sampling::nested_uniform_scramble(sampling::sobol_1(i), mix_hash(hash, 2));
+        return vec3(sampling::to_unit(u), sampling::to_unit(v), 0);
+    }
+
+private:
+    uint64_t seed;
+    uint64_t pixel = 0;
+    uint32_t index = 0;
+    uint32_t dimension = 0;
+
+    static uint32_t mix_hash(uint32_t hash, uint32_t salt) {
+        return static_cast<uint32_t>(mix_bits((static_cast<uint64_t>(salt) << 32) | hash));
+    }
+};
+
+inline std::unique_ptr<sampler> make_sampler(sampler_type type, uint64_t seed) {
+    switch (type) {
+    case sampler_type::independent:
+        return std::make_unique<independent_sampler>(seed);
+    case sampler_type::halton:
+        return std::make_unique<halton_sampler>(seed);
+    default:
+        return std::make_unique<sobol_sampler>(seed);
+    }
+}
@@ -0,0 +1,228 @@
+#pragma once
+
+#include "util.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "scene_builder.h"
+#include "wide_bvh.h"
+
+// The arrays a compiled scene traces, wherever they are stored: in a
+// compiled_scene or in a mapped scene file. prims holds one packed reference
+// per BVH leaf slot, the kind of primitive in its top bits and its index in
+// that kind's array below them. Materials are records whose texture indices
+// address textures, except those with no plain-data form, which are kept by
+// pointer in material_objects in their place.
+struct scene_arrays {
+    static constexpr uint32_t kind_shift = 30;
+    static constexpr uint32_t index_mask = (1u << kind_shift) - 1;
+    static constexpr uint32_t kind_sphere = 0;
+    static constexpr uint32_t kind_quad = 1;
+    static constexpr uint32_t kind_object = 2;
+    static constexpr uint32_t kind_instance = 3;
+
+    const sphere_data *spheres = nullptr;
+    const quad_data *quads = nullptr;
+    const instance_data *instances = nullptr;
+    const hittable *const *objects = nullptr;
+    const hittable *const *shared_objects = nullptr;
+    const material_record *materials = nullptr;
+    const material *const *material_objects = nullptr; // null for materials with a record
+    const texture_record *textures = nullptr;
+    const uint32_t *prims = nullptr;
+    wide_bvh_view tree;
+
+    static uint32_t make_ref(uint32_t kind, size_t index) {
+        return (kind << kind_shift) | static_cast<uint32_t>(index);
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const {
+        return tree.hit(r, ray_t, [&](uint32_t index, interval &t) {
+            uint32_t ref = prims[index];
+            uint32_t i = ref & index_mask;
+
+            switch (ref >> kind_shift) {
+            case kind_sphere:
+                if (!spheres[i].hit(r, t, rec))
+                    return false;
+                set_material(rec, spheres[i].material);
+                break;
+            case kind_quad:
+                if (!quads[i].hit(r, t, rec))
+                    return false;
+                set_material(rec, quads[i].material);
+                break;
+            case kind_instance:
+                if (!instances[i].hit(*shared_objects[instances[i].object], r, t, rec))
+                    return false;
+                break;
+            default:
+                if (!objects[i]->hit(r, t, rec))
+                    return false;
+                break;
+            }
+
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray &r, interval ray_t) const {
+        return tree.occluded(r, ray_t, [&](uint32_t index) {
+            uint32_t ref = prims[index];
+            uint32_t i = ref & index_mask;
+
+            switch (ref >> kind_shift) {
+            case kind_sphere:
+                return spheres[i].occluded(r, ray_t);
+            case kind_quad:
+                return quads[i].occluded(r, ray_t);
+            case kind_instance:
+                return instances[i].occluded(*shared_objects[instances[i].object], r, ray_t);
+            default:
+                return objects[i]->occluded(r, ray_t);
+            }
+        });
+    }
+
+    void set_material(hit_record &rec, uint32_t index) const {
+        rec.mat = material_objects[index];
+        rec.mat_record = &materials[index];
+        rec.textures = textures;
+    }
+};
+
+// An immutable, compact copy of a scene for rendering. Spheres and quads are
+// baked into world space and stored by value in one array per type,
+// materials are interned into a table of records with their textures in
+// another, and everything is referenced by 32-bit indices. The BVH, four
+// children wide, is built over packed primitive references, so tracing and
+// shading a ray never touch the original shared_ptr graph except for objects
+// and materials with no compact form, which are kept by pointer.
+//
+// Instances are leaves of this BVH that point at another hittable, usually a
+// compiled_scene of its own, together with a transform. That makes a
+// two-level hierarchy: this scene's BVH is the top level over instances and
+// loose primitives, and each shared object's BVH is a bottom level traced in
+// its own space.
+class compiled_scene : public hittable {
+public:
+    explicit compiled_scene(const hittable_list &world, const bvh_build_options &options = {})
+        : source(world)
+    {
+        scene_builder builder;
+        source.compile(builder);
+
+        spheres = std::move(builder.spheres);
+        quads = std::move(builder.quads);
+        instances = std::move(builder.instances);
+        objects = std::move(builder.objects);
+        shared_objects = std::move(builder.shared_objects);
+        materials.reserve(builder.materials.size());
+        material_objects.reserve(builder.materials.size());
+        for (const auto &mat : builder.materials) {
+            material_record record;
+            auto texture_count = textures.size();
+            bool encoded = mat && mat->encode(record, textures);
+            if (!encoded) {
+                // Drops any textures encoded before the one that failed.
+                textures.resize(texture_count);
+                record = { material_record::plain, 0, 0, color(0, 0, 0) };
+            }
+            materials.push_back(record);
+            material_objects.push_back(encoded ? nullptr : mat.get());
+        }
+
+        std::vector<uint32_t> refs;
+        std::vector<aabb> prim_bounds;
+        refs.reserve(spheres.size() + quads.size() + instances.size() + objects.size());
+        prim_bounds.reserve(refs.capacity());
+
+        for (size_t i = 0; i < spheres.size(); i++) {
+            refs.push_back(scene_arrays::make_ref(scene_arrays::kind_sphere, i));
+            prim_bounds.push_back(spheres[i].bounding_box());
+        }
+        for (size_t i = 0; i < quads.size(); i++) {
+            refs.push_back(scene_arrays::make_ref(scene_arrays::kind_quad, i));
+            prim_bounds.push_back(quads[i].bounding_box());
+        }
+        for (size_t i = 0; i < instances.size(); i++) {
+            refs.push_back(scene_arrays::make_ref(scene_arrays::kind_instance, i));
+            prim_bounds.push_back(instances[i].bounding_box(*shared_objects[instances[i].object]));
+        }
+        for (size_t i = 0; i < objects.size(); i++) {
+            refs.push_back(scene_arrays::make_ref(scene_arrays::kind_object, i));
+            prim_bounds.push_back(objects[i]->bounding_box());
+        }
+
+        auto order = tree.build(prim_bounds, options);
+
+        prims.reserve(order.size());
+        bbox = aabb::empty;
+        for (auto index : order) {
+            prims.push_back(refs[index]);
+            bbox = aabb(bbox, prim_bounds[index]);
+        }
+
+        arrays.spheres = spheres.data();
+        arrays.quads = quads.data();
+        arrays.instances = instances.data();
+        arrays.objects = objects.data();
+        arrays.shared_objects = shared_objects.data();
+        arrays.materials = materials.data();
+        arrays.material_objects = material_objects.data();
+        arrays.textures = textures.data();
+        arrays.prims = prims.data();
+        arrays.tree = tree.view();
+    }
+
+    // arrays points into this object's own vectors.
+    compiled_scene(const compiled_scene &) = delete;
+    compiled_scene &operator=(const compiled_scene &) = delete;
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return arrays.hit(r, ray_t, rec);
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override {
+        return arrays.occluded(r, ray_t);
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    double sah_cost() const {
+        return tree.sah_cost();
+    }
+
+    // The compiled contents, for writing the scene to a file.
+    const std::vector<sphere_data> &sphere_array() const { return spheres; }
+    const std::vector<quad_data> &quad_array() const { return quads; }
+    const std::vector<instance_data> &instance_array() const { return instances; }
+    const std::vector<const hittable *> &object_array() const { return objects; }
+    const std::vector<const hittable *> &shared_object_array() const { return shared_objects; }
+    const std::vector<material_record> &material_array() const { return materials; }
+    const std::vector<const material *> &material_object_array() const { return material_objects; }
+    const std::vector<texture_record> &texture_array() const { return textures; }
+    const std::vector<uint32_t> &prim_array() const { return prims; }
+    const wide_bvh &bvh() const { return tree; }
+
+private:
+    hittable_list source; // owns the objects and materials referenced below
+    std::vector<sphere_data> spheres;
+    std::vector<quad_data> quads;
+    std::vector<instance_data> instances;
+    std::vector<const hittable *> objects;
+    std::vector<const hittable *> shared_objects;
+    std::vector<material_record> materials;
+    std::vector<const material *> material_objects; // null for materials with a record
+    std::vector<texture_record> textures;
+
+    std::vector<uint32_t> prims; // packed kind and index, in leaf order
+    wide_bvh tree;
+    aabb bbox;
+    scene_arrays arrays;
+};
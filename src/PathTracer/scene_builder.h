@@ -0,0 +1,292 @@
+#pragma once
+
+#include "hittable.h"
+#include "transform.h"
+
+#include <unordered_map>
+#include <vector>
+
+class material;
+
+// Plain-data forms of the built-in primitives. sphere and quad wrap one of
+// these each, and a compiled scene stores them by value in typed arrays.
+
+struct sphere_data {
+    point3 center;   // at time 0
+    vec3 center_vec; // motion from time 0 to time 1
+    double radius;
+    uint32_t material;
+    uint32_t is_moving;
+
+    point3 center_at(double time) const {
+        return center + time * center_vec;
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const {
+        point3 current_center = is_moving ? center_at(r.time()) : center;
+        vec3 oc = current_center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range.
+        auto root = (h - sqrtd) / a;
+        if (!ray_t.surrounds(root)) {
+            root = (h + sqrtd) / a;
+            if (!ray_t.surrounds(root))
+                return false;
+        }
+
+        rec.t = root;
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - current_center) / radius;
+        rec.set_face_normal(r, outward_normal);
+
+        return true;
+    }
+
+    // Whether r hits the sphere within ray_t, without computing the hit point.
+    bool occluded(const ray &r, interval ray_t) const {
+        point3 current_center = is_moving ? center_at(r.time()) : center;
+        vec3 oc = current_center - r.origin();
+        auto a = r.direction().length_squared();
+        auto h = dot(r.direction(), oc);
+        auto c = oc.length_squared() - radius * radius;
+
+        auto discriminant = h * h - a * c;
+        if (discriminant < 0)
+            return false;
+
+        auto sqrtd = std::sqrt(discriminant);
+        return ray_t.surrounds((h - sqrtd) / a) || ray_t.surrounds((h + sqrtd) / a);
+    }
+
+    aabb bounding_box() const {
+        auto rvec = vec3(radius, radius, radius);
+        aabb box1(center - rvec, center + rvec);
+        if (!is_moving)
+            return box1;
+
+        auto center2 = center + center_vec;
+        aabb box2(center2 - rvec, center2 + rvec);
+        return aabb(box1, box2);
+    }
+};
+
+struct quad_data {
+    point3 Q;
+    vec3 u, v;
+    vec3 w;
+    vec3 normal;
+    double D;
+    double area;
+    uint32_t material;
+    uint32_t pad;
+
+    static quad_data make(const point3 &Q, const vec3 &u, const vec3 &v, uint32_t material) {
+        quad_data q;
+        q.Q = Q;
+        q.u = u;
+        q.v = v;
+
+        auto n = cross(u, v);
+        q.normal = unit_vector(n);
+        q.D = dot(q.normal, Q);
+        q.w = n / dot(n, n);
+        q.area = n.length();
+
+        q.material = material;
+        q.pad = 0;
+        return q;
+    }
+
+    // Intersects the quad's plane, returning the ray parameter and the planar
+    // coordinates of the hit point in terms of u and v.
+    bool hit_plane(const ray &r, interval ray_t, double &t, double &alpha, double &beta) const {
+        auto denom = dot(normal, r.direction());
+
+        if (std::fabs(denom) < 1e-8)
+            return false;
+
+        t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+            return false;
+
+        vec3 planar_hitpt_vector = r.at(t) - Q;
+        alpha = dot(w, cross(planar_hitpt_vector, v));
+        beta = dot(w, cross(u, planar_hitpt_vector));
+        return true;
+    }
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const {
+        double t, alpha, beta;
+        if (!hit_plane(r, ray_t, t, alpha, beta))
+            return false;
+
+        interval unit_interval = interval(0, 1);
+        if (!unit_interval.contains(alpha) || !unit_interval.contains(beta))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.u = alpha;
+        rec.v = beta;
+        rec.set_face_normal(r, normal);
+
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const {
+        double t, alpha, beta;
+        if (!hit_plane(r, ray_t, t, alpha, beta))
+            return false;
+
+        interval unit_interval = interval(0, 1);
+        return unit_interval.contains(alpha) && unit_interval.contains(beta);
+    }
+
+    aabb bounding_box() const {
+        // Compute the bounding box of all four vertices.
+        auto bbox_diagonal1 = aabb(Q, Q + u + v);
+        auto bbox_diagonal2 = aabb(Q + u, Q + v);
+        return aabb(bbox_diagonal1, bbox_diagonal2);
+    }
+};
+
+// A placement of a shared object, typically a compiled_scene, by an affine
+// transform. Rays are carried into the object's frame instead of the object
+// into world space, so any number of instances share one copy of the object
+// and its BVH. The object is named by its index into the scene's table of
+// shared objects, as materials are, and passed in by whoever holds that table.
+struct instance_data {
+    transform to_world;
+    transform to_object;
+    uint32_t object;
+    uint32_t pad;
+
+    // The ray in object space. The direction is not renormalized, so ray
+    // parameters mean the same in both spaces and t limits carry over.
+    ray object_ray(const ray &r) const {
+        return ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+    }
+
+    bool hit(const hittable &object, const ray &r, interval ray_t, hit_record &rec) const {
+        if (!object.hit(object_ray(r), ray_t, rec))
+            return false;
+
+        // Normals go through the inverse transpose, which keeps their sign
+        // against the ray direction and with it front_face.
+        rec.p = to_world.apply_point(rec.p);
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+
+        return true;
+    }
+
+    bool occluded(const hittable &object, const ray &r, interval ray_t) const {
+        return object.occluded(object_ray(r), ray_t);
+    }
+
+    aabb bounding_box(const hittable &object) const {
+        return to_world.apply_box(object.bounding_box());
+    }
+};
+
+// Collects the primitives of a hittable graph into typed arrays, via
+// hittable::compile. Objects with no compact form are kept by pointer.
+class scene_builder {
+public:
+    std::vector<sphere_data> spheres;
+    std::vector<quad_data> quads;
+    std::vector<instance_data> instances;
+    std::vector<const hittable *> objects;
+    std::vector<shared_ptr<material>> materials;
+    std::vector<const hittable *> shared_objects; // placed by instances
+
+    struct mark {
+        size_t spheres, quads, instances, objects;
+    };
+
+    uint32_t add_material(const shared_ptr<material> &mat) {
+        auto [it, inserted] = material_index.try_emplace(mat.get(), static_cast<uint32_t>(materials.size()));
+        if (inserted)
+            materials.push_back(mat);
+        return it->second;
+    }
+
+    uint32_t add_shared_object(const hittable *object) {
+        auto [it, inserted] = shared_object_index.try_emplace(object, static_cast<uint32_t>(shared_objects.size()));
+        if (inserted)
+            shared_objects.push_back(object);
+        return it->second;
+    }
+
+    void add(const sphere_data &s) { spheres.push_back(s); }
+    void add(const quad_data &q) { quads.push_back(q); }
+    void add(const instance_data &i) { instances.push_back(i); }
+    void add(const hittable *object) { objects.push_back(object); }
+
+    // Compiles object, or keeps it by pointer if it has no compact form.
+    void add_compiled(const hittable &object) {
+        if (!object.compile(*this))
+            add(&object);
+    }
+
+    mark current() const {
+        return { spheres.size(), quads.size(), instances.size(), objects.size() };
+    }
+
+    void rollback(const mark &m) {
+        spheres.resize(m.spheres);
+        quads.resize(m.quads);
+        instances.resize(m.instances);
+        objects.resize(m.objects);
+    }
+
+    // Compiles object and bakes a rigid transform into everything it added.
+    // Fails, leaving the builder untouched, if anything inside object had to
+    // be kept by pointer or is an instance, since those can't be moved into
+    // world space.
+    template <typename PointFn, typename VectorFn>
+    bool compile_transformed(const hittable &object, PointFn &&to_world_point, VectorFn &&to_world_vector) {
+        auto m = current();
+        if (!object.compile(*this) || objects.size() != m.objects || instances.size() != m.instances) {
+            rollback(m);
+            return false;
+        }
+
+        for (size_t i = m.spheres; i < spheres.size(); i++) {
+            spheres[i].center = to_world_point(spheres[i].center);
+            spheres[i].center_vec = to_world_vector(spheres[i].center_vec);
+        }
+
+        for (size_t i = m.quads; i < quads.size(); i++) {
+            const auto &q = quads[i];
+            quads[i] = quad_data::make(to_world_point(q.Q), to_world_vector(q.u), to_world_vector(q.v), q.material);
+        }
+
+        return true;
+    }
+
+private:
+    std::unordered_map<const material *, uint32_t> material_index;
+    std::unordered_map<const hittable *, uint32_t> shared_object_index;
+};
+
+inline bool translate::compile(scene_builder &builder) const {
+    return builder.compile_transformed(*object,
+        [&](const point3 &p) { return p + offset; },
+        [](const vec3 &v) { return v; });
+}
+
+inline bool rotate_y::compile(scene_builder &builder) const {
+    auto to_world = [&](const vec3 &v) {
+        return vec3(cos_theta * v[0] + sin_theta * v[2], v[1], -sin_theta * v[0] + cos_theta * v[2]);
+    };
+    return builder.compile_transformed(*object, to_world, to_world);
+}
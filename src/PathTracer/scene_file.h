@@ -0,0 +1,763 @@
+#pragma once
+
+#include "util.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "light_tree.h"
+#include "material.h"
+#include "quad.h"
+#include "scene.h"
+#include "scenes.h"
+#include "sphere.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+#include "wide_bvh.h"
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Scene files hold a compiled scene in the layout it is traced in: its
+// spheres, quads and instances, its meshes' vertex arrays, and the nodes of
+// every BVH, along with its materials, textures, lights and camera. A
+// renderer maps the file and traces straight from the mapped pages, with no
+// parsing and no BVH build, and processes that map the same file share its
+// pages through the page cache.
+//
+// Everything is found by offsets from the start of the file, so the mapping
+// can go anywhere. Each array of records starts on a 64-byte boundary, and
+// the records are the structs the renderer traces, with their indices as
+// they are. Only the small tables that hold pointers in memory (materials,
+// textures, objects and lights) are rebuilt when a file is opened.
+//
+// The header records the format version, the byte order and the size of
+// every record type, and files that don't match this build are refused
+// rather than misread. The tables are checked on opening but the contents of
+// the arrays are not, so a damaged file can make tracing fail: scene files
+// should come from scene_file_writer.
+namespace scene_file_format {
+
+inline constexpr char magic[8] = { 'P', 'T', 'S', 'C', 'E', 'N', 'E', '\0' };
+inline constexpr uint32_t version = 1;
+inline constexpr uint32_t byte_order_mark = 0x01020304;
+inline constexpr uint64_t alignment = 64;
+
+// count records of type T, starting offset bytes into the file.
+template <typename T>
+struct array_ref {
+    uint64_t offset;
+    uint64_t count;
+};
+
+// Something a scene keeps whole or places by instances: a mesh or another
+// scene, by index into the file's table of each.
+struct object_record {
+    enum : uint32_t { mesh = 0, scene = 1 };
+
+    uint32_t kind;
+    uint32_t index;
+};
+
+struct mesh_record {
+    array_ref<point3> positions;
+    array_ref<vec3> normals; // empty if the mesh has none
+    array_ref<vec3> uvs;     // likewise
+    array_ref<uint32_t> indices;
+    array_ref<wide_bvh_node> nodes;
+    point3 bounds_min, bounds_max;
+    uint32_t material;
+    uint32_t pad;
+};
+
+// The arrays of one compiled_scene. The indices in its records refer to its
+// own tables, as in memory; those tables hold indices into the file's.
+// A scene only refers to scenes before it, and the last is the world.
+struct scene_record {
+    array_ref<sphere_data> spheres;
+    array_ref<quad_data> quads;
+    array_ref<instance_data> instances;
+    array_ref<uint32_t> objects;        // object table entries kept whole
+    array_ref<uint32_t> shared_objects; // and placed by instances
+    array_ref<uint32_t> materials;      // material table entries
+    array_ref<uint32_t> prims;
+    array_ref<wide_bvh_node> nodes;
+    point3 bounds_min, bounds_max;
+};
+
+// One light to sample, in the order the lights were listed: a sphere or a
+// quad, by index into the light arrays. Their material fields index the
+// file's material table.
+struct light_record {
+    uint32_t kind; // scene_arrays::kind_sphere or kind_quad
+    uint32_t index;
+};
+
+struct camera_record {
+    double aspect_ratio;
+    int32_t image_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t pad;
+    double vfov;
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup;
+    double defocus_angle;
+    double focus_dist;
+    color background;
+};
+
+// The size of every record type, in the order they're stored in the header.
+inline constexpr uint32_t record_sizes[] = {
+    sizeof(point3), sizeof(sphere_data), sizeof(quad_data), sizeof(instance_data), sizeof(wide_bvh_node),
+    sizeof(texture_record), sizeof(material_record), sizeof(object_record), sizeof(mesh_record),
+    sizeof(scene_record), sizeof(light_record), sizeof(camera_record),
+};
+
+inline constexpr size_t record_type_count = sizeof(record_sizes) / sizeof(record_sizes[0]);
+
+struct header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    uint32_t record_sizes[record_type_count];
+
+    array_ref<texture_record> textures;
+    array_ref<material_record> materials;
+    array_ref<object_record> objects;
+    array_ref<mesh_record> meshes;
+    array_ref<scene_record> scenes;
+    array_ref<sphere_data> light_spheres;
+    array_ref<quad_data> light_quads;
+    array_ref<light_record> lights;
+    camera_record camera;
+};
+
+static_assert(std::is_trivially_copyable_v<sphere_data> && std::is_trivially_copyable_v<quad_data>
+              && std::is_trivially_copyable_v<instance_data> && std::is_trivially_copyable_v<wide_bvh_node>
+              && std::is_trivially_copyable_v<header>,
+              "scene file records are copied to and traced from the file byte for byte");
+
+} // namespace scene_file_format
+
+// A compiled scene traced from a mapped scene file. Its arrays point into
+// the mapping; only its material records, copied from the file's table, and
+// the tables of pointers are its own.
+class mapped_scene : public hittable {
+public:
+    mapped_scene(const scene_arrays &arrays, std::vector<material_record> materials,
+                 std::vector<const hittable *> objects, std::vector<const hittable *> shared_objects, const aabb &bbox)
+        : arrays(arrays), materials(std::move(materials)), material_objects(this->materials.size(), nullptr),
+          objects(std::move(objects)), shared_objects(std::move(shared_objects)), bbox(bbox)
+    {
+        this->arrays.materials = this->materials.data();
+        this->arrays.material_objects = material_objects.data();
+        this->arrays.objects = this->objects.data();
+        this->arrays.shared_objects = this->shared_objects.data();
+    }
+
+    mapped_scene(const mapped_scene &) = delete;
+    mapped_scene &operator=(const mapped_scene &) = delete;
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        return arrays.hit(r, ray_t, rec);
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override {
+        return arrays.occluded(r, ray_t);
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    // As compiled_scene::sah_cost, for the default build costs scenes are
+    // compiled with.
+    double sah_cost() const {
+        return arrays.tree.sah_cost();
+    }
+
+private:
+    scene_arrays arrays;
+    std::vector<material_record> materials;
+    std::vector<const material *> material_objects; // all null: files only hold records
+    std::vector<const hittable *> objects;
+    std::vector<const hittable *> shared_objects;
+    aabb bbox;
+};
+
+// Writes scenes to scene files. The world is compiled as camera::render
+// would compile it, and every object it keeps whole or places by instances
+// must be a triangle_mesh or a compiled_scene. Lights must be plain spheres
+// and quads, and materials and textures must have plain-data forms.
+class scene_file_writer {
+public:
+    // Returns false, after reporting the reason on std::cerr, if the scene
+    // can't be stored or the file can't be written.
+    bool write(const scene_setup &scene, const std::string &path) {
+        using namespace scene_file_format;
+
+        *this = scene_file_writer();
+        blob.resize(sizeof(header));
+
+        compiled_scene world(scene.world);
+        uint32_t world_index;
+        if (!add_scene(world, world_index) || !add_lights(scene.lights))
+            return false;
+
+        header h = {};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byte_order = byte_order_mark;
+        std::memcpy(h.record_sizes, record_sizes, sizeof(record_sizes));
+
+        h.textures = append(textures);
+        h.materials = append(materials);
+        h.objects = append(objects);
+        h.meshes = append(meshes);
+        h.scenes = append(scenes);
+        h.light_spheres = append(light_spheres);
+        h.light_quads = append(light_quads);
+        h.lights = append(lights);
+
+        const camera &cam = scene.cam;
+        h.camera.aspect_ratio = cam.aspect_ratio;
+        h.camera.image_width = cam.image_width;
+        h.camera.samples_per_pixel = cam.samples_per_pixel;
+        h.camera.max_depth = cam.max_depth;
+        h.camera.vfov = cam.vfov;
+        h.camera.lookfrom = cam.lookfrom;
+        h.camera.lookat = cam.lookat;
+        h.camera.vup = cam.vup;
+        h.camera.defocus_angle = cam.defocus_angle;
+        h.camera.focus_dist = cam.focus_dist;
+        h.camera.background = cam.background;
+
+        h.file_size = blob.size();
+        std::memcpy(blob.data(), &h, sizeof(h));
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file.write(blob.data(), static_cast<std::streamsize>(blob.size())) || !file.flush()) {
+            std::cerr << "Could not write " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<char> blob;
+    std::vector<texture_record> textures;
+    std::vector<material_record> materials;
+    std::vector<scene_file_format::object_record> objects;
+    std::vector<scene_file_format::mesh_record> meshes;
+    std::vector<scene_file_format::scene_record> scenes;
+    std::vector<sphere_data> light_spheres;
+    std::vector<quad_data> light_quads;
+    std::vector<scene_file_format::light_record> lights;
+    std::unordered_map<const material *, uint32_t> material_index;
+    std::unordered_map<const hittable *, uint32_t> object_index;
+
+    // Appends count records to the file, aligned, and returns where they went.
+    template <typename T>
+    scene_file_format::array_ref<T> append(const T *data, size_t count) {
+        if (count == 0)
+            return { 0, 0 };
+
+        auto alignment = scene_file_format::alignment;
+        blob.resize((blob.size() + alignment - 1) / alignment * alignment);
+        uint64_t offset = blob.size();
+        auto bytes = reinterpret_cast<const char *>(data);
+        blob.insert(blob.end(), bytes, bytes + count * sizeof(T));
+        return { offset, count };
+    }
+
+    template <typename T>
+    scene_file_format::array_ref<T> append(const std::vector<T> &v) {
+        return append(v.data(), v.size());
+    }
+
+    static void fail(const char *reason) {
+        std::cerr << "Can't store the scene: " << reason << "\n";
+    }
+
+    bool add_material(const material *mat, uint32_t &index) {
+        if (auto it = material_index.find(mat); it != material_index.end()) {
+            index = it->second;
+            return true;
+        }
+
+        material_record record;
+        std::vector<texture_record> table;
+        if (!mat || !mat->encode(record, table)) {
+            fail("a material has no plain-data form");
+            return false;
+        }
+
+        index = add_material(record, table.data());
+        material_index.emplace(mat, index);
+        return true;
+    }
+
+    // Adds a material record whose texture indexes table, with its
+    // textures, and returns its index in the file's table.
+    uint32_t add_material(material_record record, const texture_record *table) {
+        if (record.textured())
+            record.texture = add_texture(table, record.texture);
+        materials.push_back(record);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    // Adds the texture at index in table after the textures it refers to,
+    // and returns its index in the file's table.
+    uint32_t add_texture(const texture_record *table, uint32_t index) {
+        auto record = table[index];
+        if (record.kind == texture_record::checker) {
+            record.even = add_texture(table, record.even);
+            record.odd = add_texture(table, record.odd);
+        }
+        textures.push_back(record);
+        return static_cast<uint32_t>(textures.size() - 1);
+    }
+
+    bool add_object(const hittable *object, uint32_t &index) {
+        using namespace scene_file_format;
+
+        if (auto it = object_index.find(object); it != object_index.end()) {
+            index = it->second;
+            return true;
+        }
+
+        object_record record;
+        if (auto mesh = dynamic_cast<const triangle_mesh *>(object)) {
+            record = { object_record::mesh, static_cast<uint32_t>(meshes.size()) };
+            if (!add_mesh(*mesh))
+                return false;
+        } else if (auto scene = dynamic_cast<const compiled_scene *>(object)) {
+            record.kind = object_record::scene;
+            if (!add_scene(*scene, record.index))
+                return false;
+        } else {
+            fail("an object is neither a triangle_mesh nor a compiled_scene");
+            return false;
+        }
+
+        index = static_cast<uint32_t>(objects.size());
+        objects.push_back(record);
+        object_index.emplace(object, index);
+        return true;
+    }
+
+    bool add_mesh(const triangle_mesh &mesh) {
+        scene_file_format::mesh_record record = {};
+        if (!add_material(mesh.mesh_material().get(), record.material))
+            return false;
+
+        const auto &view = mesh.view();
+        const auto &tree = mesh.tree_view();
+        record.positions = append(view.positions, view.vertex_count);
+        record.normals = append(view.normals, view.normals ? view.vertex_count : 0);
+        record.uvs = append(view.uvs, view.uvs ? view.vertex_count : 0);
+        record.indices = append(view.indices, 3 * view.triangle_count);
+        record.nodes = append(tree.nodes, tree.node_count);
+
+        auto box = mesh.bounding_box();
+        record.bounds_min = point3(box.x.min, box.y.min, box.z.min);
+        record.bounds_max = point3(box.x.max, box.y.max, box.z.max);
+
+        meshes.push_back(record);
+        return true;
+    }
+
+    // Adds scene and everything it refers to, which comes before it.
+    bool add_scene(const compiled_scene &scene, uint32_t &index) {
+        scene_file_format::scene_record record = {};
+
+        std::vector<uint32_t> material_table, object_table, shared_table;
+        for (size_t i = 0; i < scene.material_array().size(); i++) {
+            if (scene.material_object_array()[i]) {
+                fail("a material has no plain-data form");
+                return false;
+            }
+            material_table.push_back(add_material(scene.material_array()[i], scene.texture_array().data()));
+        }
+        for (auto object : scene.object_array()) {
+            if (!add_object(object, object_table.emplace_back()))
+                return false;
+        }
+        for (auto object : scene.shared_object_array()) {
+            if (!add_object(object, shared_table.emplace_back()))
+                return false;
+        }
+
+        record.spheres = append(scene.sphere_array());
+        record.quads = append(scene.quad_array());
+        record.instances = append(scene.instance_array());
+        record.objects = append(object_table);
+        record.shared_objects = append(shared_table);
+        record.materials = append(material_table);
+        record.prims = append(scene.prim_array());
+        record.nodes = append(scene.bvh().nodes);
+
+        auto box = scene.bounding_box();
+        record.bounds_min = point3(box.x.min, box.y.min, box.z.min);
+        record.bounds_max = point3(box.x.max, box.y.max, box.z.max);
+
+        index = static_cast<uint32_t>(scenes.size());
+        scenes.push_back(record);
+        return true;
+    }
+
+    // Lights keep their order, which decides how the light tree is built.
+    bool add_lights(const hittable_list &light_list) {
+        for (const auto &light : light_list.objects) {
+            scene_builder builder;
+            if (!light->compile(builder) || builder.spheres.size() + builder.quads.size() != 1
+                || !builder.instances.empty() || !builder.objects.empty()) {
+                fail("a light is not a plain sphere or quad");
+                return false;
+            }
+
+            uint32_t mat;
+            if (!add_material(builder.materials[0].get(), mat))
+                return false;
+
+            if (!builder.spheres.empty()) {
+                lights.push_back({ scene_arrays::kind_sphere, static_cast<uint32_t>(light_spheres.size()) });
+                light_spheres.push_back(builder.spheres[0]);
+                light_spheres.back().material = mat;
+            } else {
+                lights.push_back({ scene_arrays::kind_quad, static_cast<uint32_t>(light_quads.size()) });
+                light_quads.push_back(builder.quads[0]);
+                light_quads.back().material = mat;
+            }
+        }
+        return true;
+    }
+};
+
+// A scene file mapped into memory, ready to trace.
+class scene_file {
+public:
+    scene_file() = default;
+
+    ~scene_file() {
+        close();
+    }
+
+    scene_file(const scene_file &) = delete;
+    scene_file &operator=(const scene_file &) = delete;
+
+    // Maps the file at path and sets up its tables. Returns false, after
+    // reporting the reason on std::cerr, if it can't be mapped or isn't a
+    // scene file this build can read.
+    bool open(const std::string &path) {
+        close();
+        if (!map(path)) {
+            std::cerr << "Could not map " << path << "\n";
+            return false;
+        }
+        if (!load()) {
+            std::cerr << path << " is not a usable scene file\n";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        light_set.reset();
+        light_list.clear();
+        scenes.clear();
+        objects.clear();
+        materials.clear();
+        textures.clear();
+        unmap();
+    }
+
+    const hittable &world() const {
+        return *scenes.back();
+    }
+
+    // The SAH cost of the world's top-level tree.
+    double sah_cost() const {
+        return scenes.back()->sah_cost();
+    }
+
+    const hittable &lights() const {
+        return *light_set;
+    }
+
+    // Sets up cam as the scene's own setup did.
+    void apply_camera(camera &cam) const {
+        const auto &c = file_header().camera;
+        cam.aspect_ratio = c.aspect_ratio;
+        cam.image_width = c.image_width;
+        cam.samples_per_pixel = c.samples_per_pixel;
+        cam.max_depth = c.max_depth;
+        cam.vfov = c.vfov;
+        cam.lookfrom = c.lookfrom;
+        cam.lookat = c.lookat;
+        cam.vup = c.vup;
+        cam.defocus_angle = c.defocus_angle;
+        cam.focus_dist = c.focus_dist;
+        cam.background = c.background;
+    }
+
+private:
+    const char *base = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file_handle = INVALID_HANDLE_VALUE;
+    HANDLE mapping_handle = nullptr;
+#endif
+
+    std::vector<shared_ptr<texture>> textures;
+    std::vector<shared_ptr<material>> materials;
+    std::vector<shared_ptr<hittable>> objects;
+    std::vector<shared_ptr<mapped_scene>> scenes;
+    hittable_list light_list;
+    std::unique_ptr<light_tree> light_set;
+
+    const scene_file_format::header &file_header() const {
+        return *reinterpret_cast<const scene_file_format::header *>(base);
+    }
+
+#ifdef _WIN32
+    bool map(const std::string &path) {
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+            return false;
+
+        mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_handle)
+            return false;
+
+        base = static_cast<const char *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+        size = static_cast<size_t>(file_size.QuadPart);
+        return base != nullptr;
+    }
+
+    void unmap() {
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping_handle)
+            CloseHandle(mapping_handle);
+        if (file_handle != INVALID_HANDLE_VALUE)
+            CloseHandle(file_handle);
+        base = nullptr;
+        size = 0;
+        mapping_handle = nullptr;
+        file_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    bool map(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        // The mapping keeps the file open by itself.
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+            p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+
+        base = static_cast<const char *>(p);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+    }
+
+    void unmap() {
+        if (base)
+            munmap(const_cast<char *>(base), size);
+        base = nullptr;
+        size = 0;
+    }
+#endif
+
+    // Whether a lies within the file, aligned.
+    template <typename T>
+    bool valid(const scene_file_format::array_ref<T> &a) const {
+        if (a.count == 0)
+            return true;
+        return a.offset % scene_file_format::alignment == 0 && a.offset <= size
+            && a.count <= (size - a.offset) / sizeof(T);
+    }
+
+    static aabb bounds(const point3 &min, const point3 &max) {
+        return aabb(interval(min.x(), max.x()), interval(min.y(), max.y()), interval(min.z(), max.z()));
+    }
+
+    template <typename T>
+    const T *resolve(const scene_file_format::array_ref<T> &a) const {
+        return a.count ? reinterpret_cast<const T *>(base + a.offset) : nullptr;
+    }
+
+    // Checks the header and tables and builds the objects that trace the
+    // mapped arrays.
+    bool load() {
+        using namespace scene_file_format;
+
+        if (size < sizeof(header))
+            return false;
+
+        const auto &h = file_header();
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version
+            || h.byte_order != byte_order_mark || h.file_size != size
+            || std::memcmp(h.record_sizes, record_sizes, sizeof(record_sizes)) != 0)
+            return false;
+
+        if (!valid(h.textures) || !valid(h.materials) || !valid(h.objects) || !valid(h.meshes) || !valid(h.scenes)
+            || !valid(h.light_spheres) || !valid(h.light_quads) || !valid(h.lights) || h.scenes.count == 0)
+            return false;
+
+        // Textures only refer to textures before them, so one pass decodes them.
+        const auto *texture_records = resolve(h.textures);
+        for (size_t i = 0; i < h.textures.count; i++) {
+            const auto &t = texture_records[i];
+            if (t.kind > texture_record::checker || (t.kind == texture_record::checker && (t.even >= i || t.odd >= i)))
+                return false;
+            textures.push_back(decode_texture(t, textures));
+        }
+
+        const auto *material_records = resolve(h.materials);
+        for (size_t i = 0; i < h.materials.count; i++) {
+            const auto &m = material_records[i];
+            if (m.kind > material_record::isotropic || (m.textured() && m.texture >= textures.size()))
+                return false;
+            materials.push_back(decode_material(m, textures));
+        }
+
+        // Meshes first; scenes only refer to scenes before them, so they fill
+        // in their own entries as they go.
+        const auto *object_records = resolve(h.objects);
+        const auto *mesh_records = resolve(h.meshes);
+        objects.resize(h.objects.count);
+        for (size_t i = 0; i < h.objects.count; i++) {
+            const auto &o = object_records[i];
+            if (o.kind == object_record::scene) {
+                if (o.index >= h.scenes.count)
+                    return false;
+                continue;
+            }
+            if (o.kind != object_record::mesh || o.index >= h.meshes.count)
+                return false;
+
+            const auto &m = mesh_records[o.index];
+            if (!valid(m.positions) || !valid(m.normals) || !valid(m.uvs) || !valid(m.indices) || !valid(m.nodes)
+                || (m.normals.count && m.normals.count != m.positions.count)
+                || (m.uvs.count && m.uvs.count != m.positions.count)
+                || m.indices.count % 3 != 0 || m.material >= materials.size())
+                return false;
+
+            mesh_view view;
+            view.positions = resolve(m.positions);
+            view.normals = resolve(m.normals);
+            view.uvs = resolve(m.uvs);
+            view.indices = resolve(m.indices);
+            view.vertex_count = m.positions.count;
+            view.triangle_count = m.indices.count / 3;
+            wide_bvh_view tree{ resolve(m.nodes), static_cast<size_t>(m.nodes.count) };
+            objects[i] = make_shared<triangle_mesh>(view, tree, bounds(m.bounds_min, m.bounds_max),
+                                                    materials[m.material]);
+        }
+
+        const auto *scene_records = resolve(h.scenes);
+        for (size_t s = 0; s < h.scenes.count; s++) {
+            const auto &r = scene_records[s];
+            if (!valid(r.spheres) || !valid(r.quads) || !valid(r.instances) || !valid(r.objects)
+                || !valid(r.shared_objects) || !valid(r.materials) || !valid(r.prims) || !valid(r.nodes))
+                return false;
+
+            std::vector<material_record> scene_materials;
+            for (size_t i = 0; i < r.materials.count; i++) {
+                auto index = resolve(r.materials)[i];
+                if (index >= h.materials.count)
+                    return false;
+                scene_materials.push_back(material_records[index]);
+            }
+
+            std::vector<const hittable *> scene_objects, scene_shared;
+            if (!resolve_objects(r.objects, s, scene_objects) || !resolve_objects(r.shared_objects, s, scene_shared))
+                return false;
+
+            scene_arrays arrays;
+            arrays.spheres = resolve(r.spheres);
+            arrays.quads = resolve(r.quads);
+            arrays.instances = resolve(r.instances);
+            arrays.textures = texture_records;
+            arrays.prims = resolve(r.prims);
+            arrays.tree = wide_bvh_view{ resolve(r.nodes), static_cast<size_t>(r.nodes.count) };
+
+            auto scene = make_shared<mapped_scene>(arrays, std::move(scene_materials), std::move(scene_objects),
+                                                   std::move(scene_shared), bounds(r.bounds_min, r.bounds_max));
+            scenes.push_back(scene);
+            for (size_t i = 0; i < h.objects.count; i++) {
+                if (object_records[i].kind == object_record::scene && object_records[i].index == s)
+                    objects[i] = scene;
+            }
+        }
+
+        const auto *light_records = resolve(h.lights);
+        for (size_t i = 0; i < h.lights.count; i++) {
+            const auto &l = light_records[i];
+            if (l.kind == scene_arrays::kind_sphere && l.index < h.light_spheres.count) {
+                const auto &s = resolve(h.light_spheres)[l.index];
+                if (s.material >= materials.size())
+                    return false;
+                light_list.add(make_shared<sphere>(s, materials[s.material]));
+            } else if (l.kind == scene_arrays::kind_quad && l.index < h.light_quads.count) {
+                const auto &q = resolve(h.light_quads)[l.index];
+                if (q.material >= materials.size())
+                    return false;
+                light_list.add(make_shared<quad>(q.Q, q.u, q.v, materials[q.material]));
+            } else {
+                return false;
+            }
+        }
+        light_set = std::make_unique<light_tree>(light_list);
+
+        return true;
+    }
+
+    // Looks up the objects listed in table for scene, which may only refer
+    // to meshes and to scenes before it.
+    bool resolve_objects(const scene_file_format::array_ref<uint32_t> &table, size_t scene,
+                         std::vector<const hittable *> &out) const {
+        const auto *object_records = resolve(file_header().objects);
+        for (size_t i = 0; i < table.count; i++) {
+            auto index = resolve(table)[i];
+            if (index >= objects.size())
+                return false;
+            const auto &o = object_records[index];
+            if (o.kind == scene_file_format::object_record::scene && o.index >= scene)
+                return false;
+            out.push_back(objects[index].get());
+        }
+        return true;
+    }
+};
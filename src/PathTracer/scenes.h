@@ -0,0 +1,432 @@
+#pragma once
+
+#include "util.h"
+
+#include "bvh.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "quad.h"
+#include "scene.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+// A world, the lights to sample in it, and a camera framing it. Each light
+// is a copy of an emitter in the world, with the same emissive material.
+struct scene_setup {
+    hittable_list world;
+    hittable_list lights;
+    camera cam;
+};
+
+inline scene_setup static_spheres() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    auto checker = make_shared<checker_texture>(0.32, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 1200;
+    cam.samples_per_pixel = 10;
+    cam.max_depth = 5;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+
+    return scene;
+}
+
+inline scene_setup quads() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    // Materials
+    auto left_red = make_shared<lambertian>(color(1.0, 0.2, 0.2));
+    auto back_green = make_shared<lambertian>(color(0.2, 1.0, 0.2));
+    auto right_blue = make_shared<lambertian>(color(0.2, 0.2, 1.0));
+    auto upper_orange = make_shared<lambertian>(color(1.0, 0.5, 0.0));
+    auto lower_teal = make_shared<lambertian>(color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(make_shared<quad>(point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+    world.add(make_shared<quad>(point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(make_shared<quad>(point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(make_shared<quad>(point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(make_shared<quad>(point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 80;
+    cam.lookfrom = point3(0, 0, 9);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+inline scene_setup simple_light() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.4, 0.5, 0.4))));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 2, make_shared<lambertian>(color(0.9, 0.9, 1.0))));
+
+    scene.lights.add(make_shared<quad>(point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), make_shared<material>()));
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 200;
+    cam.max_depth = 20;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(26, 3, 6);
+    cam.lookat = point3(0, 2, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+inline scene_setup cornell_box() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    //// Box
+    //shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
+    //box1 = make_shared<rotate_y>(box1, 15);
+    //box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    //world.add(box1);
+
+    //// Glass Sphere
+    //auto glass = make_shared<dielectric>(1.5);
+    //world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+
+    // Light Sources, with the materials they emit through
+    scene.lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    // scene.lights.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 30;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+inline scene_setup lava() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+    auto light = make_shared<diffuse_light>(color(15, 15, 15));
+
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    // Box
+    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    world.add(box1);
+
+    // Light Sources, with the materials they emit through
+    scene.lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 10;
+    cam.max_depth = 5;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+// The Cornell box lit by a grid of small ceiling lights of random colour and
+// brightness instead of one large one.
+inline scene_setup many_lights() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    auto red = make_shared<lambertian>(color(.65, .05, .05));
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    auto green = make_shared<lambertian>(color(.12, .45, .15));
+
+    world.add(make_shared<quad>(point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(make_shared<quad>(point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(make_shared<quad>(point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(make_shared<quad>(point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    world.add(box1);
+
+    shared_ptr<hittable> box2 = box(point3(0, 0, 0), point3(165, 165, 165), white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    world.add(box2);
+
+    // A 32 x 32 grid of 8 x 8 lights, facing down from just under the ceiling.
+    const int grid = 32;
+    const double pitch = 555.0 / grid;
+    const double size = 8;
+    for (int i = 0; i < grid; i++) {
+        for (int j = 0; j < grid; j++) {
+            auto emit = color::random(0.2, 1) * random_double(20, 200);
+            auto light = make_shared<diffuse_light>(emit);
+            point3 corner((i + 0.5) * pitch + size / 2, 554, (j + 0.5) * pitch + size / 2);
+            auto q = make_shared<quad>(corner, vec3(-size, 0, 0), vec3(0, 0, -size), light);
+            world.add(q);
+            scene.lights.add(q);
+        }
+    }
+
+    world = hittable_list(make_shared<bvh_node>(world));
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 1.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 10;
+    cam.background = color(0, 0, 0);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(278, 278, -800);
+    cam.lookat = point3(278, 278, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+inline scene_setup instances() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
+    world.add(make_shared<quad>(point3(-60, 0, -60), vec3(120, 0, 0), vec3(0, 0, 120), ground));
+
+    // One small model, compiled once with its own BVH...
+    hittable_list model;
+    model.add(box(point3(-0.3, 0, -0.3), point3(0.3, 0.6, 0.3), make_shared<lambertian>(color(0.8, 0.3, 0.2))));
+    model.add(make_shared<sphere>(point3(0, 0.85, 0), 0.25, make_shared<metal>(color(0.8, 0.8, 0.9), 0.1)));
+    auto shared_model = make_shared<compiled_scene>(model);
+
+    // ...placed 10,000 times, each turned and scaled differently.
+    const int grid = 100;
+    for (int i = 0; i < grid; i++) {
+        for (int j = 0; j < grid; j++) {
+            auto scale = random_double(0.6, 1.2);
+            auto to_world = transform::translation(vec3(i - grid / 2 + 0.5, 0, j - grid / 2 + 0.5))
+                          * transform::rotation(vec3(0, 1, 0), random_double(0, 360))
+                          * transform::scaling(vec3(scale, scale, scale));
+            world.add(make_shared<instance>(shared_model, to_world));
+        }
+    }
+
+    auto light = make_shared<diffuse_light>(color(4, 4, 4));
+    auto lamp = make_shared<quad>(point3(-10, 30, -10), vec3(20, 0, 0), vec3(0, 0, 20), light);
+    world.add(lamp);
+    scene.lights.add(lamp);
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 10;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 40;
+    cam.lookfrom = point3(0, 12, 40);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+// A square of rolling terrain, n x n quads split into two triangles each,
+// with smooth normals from the height function's gradient.
+inline mesh_buffers terrain_mesh(int n, double size) {
+    auto height = [](double x, double z) {
+        return 0.6 * std::sin(0.35 * x) * std::cos(0.3 * z) + 0.25 * std::sin(1.1 * x + 0.7 * z);
+    };
+
+    mesh_buffers mesh;
+    mesh.positions.reserve(size_t(n + 1) * (n + 1));
+    mesh.normals.reserve(mesh.positions.capacity());
+    mesh.uvs.reserve(mesh.positions.capacity());
+    for (int j = 0; j <= n; j++) {
+        for (int i = 0; i <= n; i++) {
+            auto x = size * (double(i) / n - 0.5);
+            auto z = size * (double(j) / n - 0.5);
+            const double h = 1e-4;
+            auto dx = (height(x + h, z) - height(x - h, z)) / (2 * h);
+            auto dz = (height(x, z + h) - height(x, z - h)) / (2 * h);
+            mesh.positions.push_back(point3(x, height(x, z), z));
+            mesh.normals.push_back(unit_vector(vec3(-dx, 1, -dz)));
+            mesh.uvs.push_back(vec3(double(i) / n, double(j) / n, 0));
+        }
+    }
+
+    mesh.indices.reserve(size_t(n) * n * 6);
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            uint32_t a = j * (n + 1) + i, b = a + 1, c = a + (n + 1), d = c + 1;
+            mesh.indices.insert(mesh.indices.end(), { a, c, b, b, c, d });
+        }
+    }
+    return mesh;
+}
+
+inline scene_setup mesh() {
+    scene_setup scene;
+    auto &world = scene.world;
+
+    // 2 x 512 x 512 triangles.
+    auto checker = make_shared<checker_texture>(1.0, color(.2, .3, .1), color(.9, .9, .9));
+    world.add(make_shared<triangle_mesh>(terrain_mesh(512, 40), make_shared<lambertian>(checker)));
+    world.add(make_shared<sphere>(point3(0, 2, 0), 1.5, make_shared<dielectric>(1.5)));
+
+    auto light = make_shared<diffuse_light>(color(6, 6, 6));
+    auto lamp = make_shared<quad>(point3(-5, 20, -5), vec3(10, 0, 0), vec3(0, 0, 10), light);
+    world.add(lamp);
+    scene.lights.add(lamp);
+
+    camera &cam = scene.cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 400;
+    cam.samples_per_pixel = 64;
+    cam.max_depth = 10;
+    cam.background = color(0.70, 0.80, 1.00);
+
+    cam.vfov = 35;
+    cam.lookfrom = point3(0, 8, 22);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+
+    return scene;
+}
+
+struct named_scene {
+    const char *name;
+    scene_setup (*make)();
+};
+
+inline const named_scene builtin_scenes[] = {
+    { "static_spheres", static_spheres },
+    { "quads",          quads },
+    { "simple_light",   simple_light },
+    { "cornell_box",    cornell_box },
+    { "lava",           lava },
+    { "many_lights",    many_lights },
+    { "instances",      instances },
+    { "mesh",           mesh },
+};
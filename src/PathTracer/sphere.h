@@ -1,58 +1,41 @@
 #pragma once
 
 #include "hittable.h"
+#include "material.h"
 #include "onb.h"
 
 class sphere : public hittable {
 public:
     sphere(const point3 &center, double radius, shared_ptr<material> mat)
-        : center1(center), radius(std::fmax(0, radius)), mat(mat), is_moving(false)
+        : geometry{ center, vec3(0, 0, 0), std::fmax(0, radius), 0, false }, mat(mat)
     {
-        auto rvec = vec3(radius, radius, radius);
-		bbox = aabb(center1 - rvec, center1 + rvec);
+        bbox = geometry.bounding_box();
     }
 
     sphere(const point3 &center1, const point3 &center2, double radius, shared_ptr<material>mat)
-        : center1(center1), radius(std::fmax(0, radius)), mat(mat), is_moving(true)
+        : geometry{ center1, center2 - center1, std::fmax(0, radius), 0, true }, mat(mat)
     {
-		auto rvec = vec3(radius, radius, radius);
-		aabb box1(center1 - rvec, center1 + rvec);
-		aabb box2(center2 - rvec, center2 + rvec);
-		bbox = aabb(box1, box2);
+        bbox = geometry.bounding_box();
+    }
 
-        center_vec = center2 - center1;
+    // A sphere from its compiled form, as stored in a scene file.
+    sphere(const sphere_data &geometry, shared_ptr<material> mat) : geometry(geometry), mat(mat) {
+        this->geometry.material = 0;
+        bbox = this->geometry.bounding_box();
     }
 
     bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
-		point3 center = is_moving ? sphere_center(r.time()) : center1;
-        vec3 oc = center - r.origin();
-        auto a = r.direction().length_squared();
-        auto h = dot(r.direction(), oc);
-        auto c = oc.length_squared() - radius * radius;
-
-        auto discriminant = h * h - a * c;
-        if (discriminant < 0)
+        if (!geometry.hit(r, ray_t, rec))
             return false;
 
-        auto sqrtd = std::sqrt(discriminant);
-
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root)) {
-            root = (h + sqrtd) / a;
-            if (!ray_t.surrounds(root))
-                return false;
-        }
-
-        rec.t = root;
-        rec.p = r.at(rec.t);
-		vec3 outward_normal = (rec.p - center) / radius;
-		rec.set_face_normal(r, outward_normal);
-        rec.mat = mat;
-
+        rec.set_material(mat.get());
         return true;
     }
 
+    bool occluded(const ray &r, interval ray_t) const override {
+        return geometry.occluded(r, ray_t);
+    }
+
 	aabb bounding_box() const override {
 		return bbox;
 	}
@@ -62,34 +45,43 @@ public:
 		if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
 			return 0;
 
-		auto cos_theta_max = std::sqrt(1 - radius * radius / (center1 - origin).length_squared());
+        auto radius = geometry.radius;
+		auto cos_theta_max = std::sqrt(1 - radius * radius / (geometry.center - origin).length_squared());
 		auto solid_angle = 2 * pi * (1 - cos_theta_max);
 
 		return 1 / solid_angle;
     }
 
-	vec3 random(const point3 &origin) const override {
-		vec3 direction = center1 - origin;
+    light_bounds bounds_as_light() const override {
+        auto radius = geometry.radius;
+        light_bounds b;
+        b.bounds = bbox;
+        b.phi = mat ? luminance(mat->mean_emission()) * 4 * pi * radius * radius * pi : 0;
+        return b;
+    }
+
+	vec3 random(const point3 &origin, const vec3 &u) const override {
+		vec3 direction = geometry.center - origin;
 		auto distance_squared = direction.length_squared();
 		onb uvw(direction);
-		return uvw.transform(random_to_sphere(radius, distance_squared));
+		return uvw.transform(random_to_sphere(geometry.radius, distance_squared, u));
 	}
 
+    bool compile(scene_builder &builder) const override {
+        auto s = geometry;
+        s.material = builder.add_material(mat);
+        builder.add(s);
+        return true;
+    }
+
 private:
-    point3 center1;
-    double radius;
+    sphere_data geometry;
 	shared_ptr<material> mat;
-    bool is_moving;
-    vec3 center_vec;
 	aabb bbox;
 
-    point3 sphere_center(double time) const {
-		return center1 + time * center_vec;
-    }
-
-    static vec3 random_to_sphere(double radius, double distance_squared) {
-        auto r1 = random_double();
-        auto r2 = random_double();
+    static vec3 random_to_sphere(double radius, double distance_squared, const vec3 &u) {
+        auto r1 = u.x();
+        auto r2 = u.y();
         auto z = 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1);
 
         auto phi = 2 * pi * r1;
@@ -2,11 +2,31 @@
 
 #include "util.h"
 
+#include <vector>
+
+// A texture as plain data, for scene files. A checker names its two
+// textures by their index in the same table, which is always below its own.
+struct texture_record {
+	enum : uint32_t { solid = 0, checker = 1 };
+
+	uint32_t kind;
+	uint32_t even, odd;
+	uint32_t pad;
+	double inv_scale;
+	color albedo;
+};
+
 class texture {
 public:
 	virtual ~texture() = default;
 
 	virtual color value(double u, double v, const point3 &p) const = 0;
+
+	// Appends this texture, after any it refers to, to table and sets index to
+	// its position there. Textures with no plain-data form return false.
+	virtual bool encode(std::vector<texture_record> &table, uint32_t &index) const {
+		return false;
+	}
 };
 
 class solid_color : public texture {
@@ -19,6 +39,12 @@ public:
 		return albedo;
 	}
 
+	bool encode(std::vector<texture_record> &table, uint32_t &index) const override {
+		index = static_cast<uint32_t>(table.size());
+		table.push_back({ texture_record::solid, 0, 0, 0, 0, albedo });
+		return true;
+	}
+
 private:
 	color albedo;
 };
@@ -32,17 +58,54 @@ public:
 		: checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
 
 	color value(double u, double v, const point3 &p) const override {
+		return is_even(inv_scale, p) ? even->value(u, v, p) : odd->value(u, v, p);
+	}
+
+	// Whether p falls in an even cell of the checkerboard.
+	static bool is_even(double inv_scale, const point3 &p) {
 		auto x_int = static_cast<int>(std::floor(inv_scale * p.x()));
 		auto y_int = static_cast<int>(std::floor(inv_scale * p.y()));
 		auto z_int = static_cast<int>(std::floor(inv_scale * p.z()));
 
-		bool is_even = (x_int + y_int + z_int) % 2 == 0;
+		return (x_int + y_int + z_int) % 2 == 0;
+	}
+
+	bool encode(std::vector<texture_record> &table, uint32_t &index) const override {
+		uint32_t even_index, odd_index;
+		if (!even->encode(table, even_index) || !odd->encode(table, odd_index))
+			return false;
 
-		return is_even ? even->value(u, v, p) : odd->value(u, v, p);
+		index = static_cast<uint32_t>(table.size());
+		table.push_back({ texture_record::checker, even_index, odd_index, 0, inv_scale, color(0, 0, 0) });
+		return true;
 	}
 
 private:
 	double inv_scale;
 	shared_ptr<texture> even;
 	shared_ptr<texture> odd;
+
+	friend shared_ptr<texture> decode_texture(const texture_record &, const std::vector<shared_ptr<texture>> &);
 };
+
+// Rebuilds a texture from its record. The textures it refers to are taken
+// from decoded, which holds those before it in its table.
+inline shared_ptr<texture> decode_texture(const texture_record &record, const std::vector<shared_ptr<texture>> &decoded) {
+	if (record.kind == texture_record::solid)
+		return make_shared<solid_color>(record.albedo);
+
+	// The scale is kept as stored, rather than inverted twice.
+	auto checker = make_shared<checker_texture>(1.0, decoded[record.even], decoded[record.odd]);
+	checker->inv_scale = record.inv_scale;
+	return checker;
+}
+
+// The value of the texture at index in table, the same as the texture
+// decode_texture would rebuild from it gives. Checkers refer to textures
+// before them, so following them always ends at a solid color.
+inline color texture_value(const texture_record *table, uint32_t index, double u, double v, const point3 &p) {
+	const auto *t = &table[index];
+	while (t->kind == texture_record::checker)
+		t = &table[checker_texture::is_even(t->inv_scale, p) ? t->even : t->odd];
+	return t->albedo;
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads, each owning a deque of tasks. Workers pop
+// from the back of their own deque and steal from the front of the others'
+// when they run dry, so long-running tasks don't leave cores idle.
+class thread_pool {
+public:
+    using task = std::function<void()>;
+
+    // A thread_count of 0 uses every hardware thread. The thread that waits on
+    // a task_group also runs tasks, so only thread_count - 1 workers are spawned.
+    explicit thread_pool(int thread_count = 0) {
+        if (thread_count <= 0)
+            thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        num_threads = thread_count;
+
+        for (int i = 0; i < thread_count; i++)
+            queues.push_back(std::make_unique<task_queue>());
+
+        for (int i = 1; i < thread_count; i++)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (auto &worker : workers)
+            worker.join();
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    int size() const {
+        return num_threads;
+    }
+
+    // Queues a task. Tasks submitted from a worker go to its own deque; tasks
+    // submitted from outside go to queue_hint, or round-robin if it is negative.
+    void submit(task t, int queue_hint = -1) {
+        int index = queue_hint;
+        if (current_pool() == this && current_index() >= 0)
+            index = current_index();
+        else if (index < 0)
+            index = static_cast<int>(next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+
+        // Count the task before it becomes visible, so a worker that pops it
+        // straight away never takes the count below zero.
+        queued.fetch_add(1);
+
+        {
+            auto &q = *queues[index % queues.size()];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(t));
+        }
+
+        // A worker checks queued and goes to sleep while holding sleep_mutex,
+        // so passing through it here means the worker either saw the new
+        // count or is already waiting for this notification.
+        { std::lock_guard<std::mutex> lock(sleep_mutex); }
+        wake.notify_one();
+    }
+
+    // Runs one queued task on the calling thread, if there is one.
+    bool run_pending_task() {
+        int self = (current_pool() == this) ? current_index() : 0;
+
+        task t;
+        if (!pop_task(self, t))
+            return false;
+
+        t();
+        return true;
+    }
+
+private:
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    int num_threads;
+    std::vector<std::unique_ptr<task_queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<size_t> queued{0}; // tasks in all the deques
+    bool stopping = false;
+
+    static const thread_pool *&current_pool() {
+        thread_local const thread_pool *pool = nullptr;
+        return pool;
+    }
+
+    static int &current_index() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    bool pop_task(int self, task &t) {
+        // Own deque first, newest task first.
+        {
+            auto &q = *queues[self];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                t = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                take_queued();
+                return true;
+            }
+        }
+
+        // Then steal the oldest task from another deque.
+        auto count = static_cast<int>(queues.size());
+        for (int offset = 1; offset < count; offset++) {
+            auto &q = *queues[(self + offset) % count];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (!q.tasks.empty()) {
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                take_queued();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void take_queued() {
+        queued.fetch_sub(1);
+    }
+
+    void worker_loop(int index) {
+        current_pool() = this;
+        current_index() = index;
+
+        while (true) {
+            task t;
+            if (pop_task(index, t)) {
+                t();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+};
+
+// Tracks a batch of tasks submitted to a thread_pool. wait() runs queued tasks
+// on the calling thread until the whole batch has finished, so task groups can
+// be nested inside tasks without deadlocking the pool.
+class task_group {
+public:
+    explicit task_group(thread_pool &pool) : pool(pool) {}
+
+    ~task_group() {
+        wait();
+    }
+
+    task_group(const task_group &) = delete;
+    task_group &operator=(const task_group &) = delete;
+
+    void run(std::function<void()> fn, int queue_hint = -1) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([this, fn = std::move(fn)] {
+            fn();
+            pending.fetch_sub(1, std::memory_order_release);
+        }, queue_hint);
+    }
+
+    void wait() {
+        while (pending.load(std::memory_order_acquire) > 0) {
+            if (!pool.run_pending_task())
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    thread_pool &pool;
+    std::atomic<int> pending{0};
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "util.h"
+
+#include "aabb.h"
+
+// An affine transform, stored as the top three rows of a 4x4 matrix.
+class transform {
+public:
+    double m[3][4];
+
+    transform() : transform(identity()) {}
+
+    static transform identity() {
+        return from_rows(1, 0, 0, 0,
+                         0, 1, 0, 0,
+                         0, 0, 1, 0);
+    }
+
+    static transform translation(const vec3 &offset) {
+        return from_rows(1, 0, 0, offset.x(),
+                         0, 1, 0, offset.y(),
+                         0, 0, 1, offset.z());
+    }
+
+    static transform scaling(const vec3 &scale) {
+        return from_rows(scale.x(), 0, 0, 0,
+                         0, scale.y(), 0, 0,
+                         0, 0, scale.z(), 0);
+    }
+
+    // Rotation by angle degrees about axis, counterclockwise looking down
+    // the axis towards the origin.
+    static transform rotation(const vec3 &axis, double angle) {
+        auto a = unit_vector(axis);
+        auto radians = degrees_to_radians(angle);
+        auto s = std::sin(radians);
+        auto c = std::cos(radians);
+        auto t = 1 - c;
+
+        return from_rows(t * a.x() * a.x() + c,         t * a.x() * a.y() - s * a.z(), t * a.x() * a.z() + s * a.y(), 0,
+                         t * a.x() * a.y() + s * a.z(), t * a.y() * a.y() + c,         t * a.y() * a.z() - s * a.x(), 0,
+                         t * a.x() * a.z() - s * a.y(), t * a.y() * a.z() + s * a.x(), t * a.z() * a.z() + c,         0);
+    }
+
+    static transform from_rows(double m00, double m01, double m02, double m03,
+                               double m10, double m11, double m12, double m13,
+                               double m20, double m21, double m22, double m23) {
+        transform t(no_init);
+        double values[3][4] = { { m00, m01, m02, m03 }, { m10, m11, m12, m13 }, { m20, m21, m22, m23 } };
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 4; j++)
+                t.m[i][j] = values[i][j];
+        return t;
+    }
+
+    point3 apply_point(const point3 &p) const {
+        return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3 &v) const {
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    // Multiplies v by the transpose of the linear part. Called on the
+    // inverse of a transform, this carries normals through the transform.
+    vec3 apply_transposed(const vec3 &v) const {
+        return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    // The bounding box of box after the transform, from its eight corners.
+    aabb apply_box(const aabb &box) const {
+        point3 min(infinity, infinity, infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    point3 corner(i ? box.x.max : box.x.min, j ? box.y.max : box.y.min, k ? box.z.max : box.z.min);
+                    auto p = apply_point(corner);
+                    for (int c = 0; c < 3; c++) {
+                        min[c] = std::fmin(min[c], p[c]);
+                        max[c] = std::fmax(max[c], p[c]);
+                    }
+                }
+            }
+        }
+
+        return aabb(min, max);
+    }
+
+    // This transform applied after b.
+    transform operator*(const transform &b) const {
+        transform r(no_init);
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 4; j++) {
+                r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+                if (j == 3)
+                    r.m[i][j] += m[i][3];
+            }
+        }
+        return r;
+    }
+
+    // The inverse, by the adjugate of the linear part. Singular transforms
+    // have none; this returns a transform of infinities and NaNs for them.
+    transform inverse() const {
+        auto a = m[0][0], b = m[0][1], c = m[0][2];
+        auto d = m[1][0], e = m[1][1], f = m[1][2];
+        auto g = m[2][0], h = m[2][1], i = m[2][2];
+
+        auto A = e * i - f * h;
+        auto B = f * g - d * i;
+        auto C = d * h - e * g;
+        auto inv_det = 1 / (a * A + b * B + c * C);
+
+        transform r(no_init);
+        r.m[0][0] = A * inv_det;
+        r.m[0][1] = (c * h - b * i) * inv_det;
+        r.m[0][2] = (b * f - c * e) * inv_det;
+        r.m[1][0] = B * inv_det;
+        r.m[1][1] = (a * i - c * g) * inv_det;
+        r.m[1][2] = (c * d - a * f) * inv_det;
+        r.m[2][0] = C * inv_det;
+        r.m[2][1] = (b * g - a * h) * inv_det;
+        r.m[2][2] = (a * e - b * d) * inv_det;
+
+        for (int row = 0; row < 3; row++)
+            r.m[row][3] = -(r.m[row][0] * m[0][3] + r.m[row][1] * m[1][3] + r.m[row][2] * m[2][3]);
+
+        return r;
+    }
+
+private:
+    struct no_init_t {};
+    static constexpr no_init_t no_init{};
+
+    explicit transform(no_init_t) {}
+};
@@ -0,0 +1,247 @@
+#pragma once
+
+#include "util.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "wide_bvh.h"
+
+#include <vector>
+
+// Vertex data shared by the triangles of a mesh. normals and uvs are optional
+// and, when present, hold one entry per position. UVs are kept in x and y.
+struct mesh_buffers {
+    std::vector<point3> positions;
+    std::vector<vec3> normals;
+    std::vector<vec3> uvs;
+    std::vector<uint32_t> indices; // three per triangle
+};
+
+// The vertex arrays a triangle_mesh traces, wherever they are stored: in its
+// own mesh_buffers or in a mapped scene file. normals and uvs are null when
+// the mesh has none.
+struct mesh_view {
+    const point3 *positions = nullptr;
+    const vec3 *normals = nullptr;
+    const vec3 *uvs = nullptr;
+    const uint32_t *indices = nullptr;
+    size_t vertex_count = 0;
+    size_t triangle_count = 0;
+};
+
+// A mesh of triangles over shared, indexed vertex buffers, all with one
+// material. The triangles are leaves of the mesh's own BVH and exist only as
+// index triples, reordered into leaf order after the build, so a mesh of any
+// size costs its buffers and its tree and no object per face. A compiled
+// scene keeps the mesh by pointer and traces it through that tree.
+//
+// A mesh can also trace arrays and a tree it doesn't own, such as those of a
+// mapped scene file, which must then outlive it.
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh(mesh_buffers buffers, shared_ptr<material> mat, const bvh_build_options &options = {})
+        : buffers(std::move(buffers)), mat(mat)
+    {
+        auto &positions = this->buffers.positions;
+        auto &indices = this->buffers.indices;
+        indices.resize(indices.size() - indices.size() % 3);
+
+        std::vector<aabb> prim_bounds;
+        prim_bounds.reserve(indices.size() / 3);
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            const auto &p0 = positions[indices[i]];
+            const auto &p1 = positions[indices[i + 1]];
+            const auto &p2 = positions[indices[i + 2]];
+            prim_bounds.push_back(aabb(aabb(p0, p1), aabb(p2, p2)));
+        }
+
+        auto order = owned_tree.build(prim_bounds, options);
+
+        std::vector<uint32_t> sorted(indices.size());
+        bbox = aabb::empty;
+        for (size_t slot = 0; slot < order.size(); slot++) {
+            for (int k = 0; k < 3; k++)
+                sorted[3 * slot + k] = indices[3 * order[slot] + k];
+            bbox = aabb(bbox, prim_bounds[order[slot]]);
+        }
+        indices = std::move(sorted);
+
+        mesh.positions = positions.data();
+        mesh.normals = this->buffers.normals.empty() ? nullptr : this->buffers.normals.data();
+        mesh.uvs = this->buffers.uvs.empty() ? nullptr : this->buffers.uvs.data();
+        mesh.indices = indices.data();
+        mesh.vertex_count = positions.size();
+        mesh.triangle_count = indices.size() / 3;
+        tree = owned_tree.view();
+    }
+
+    // A mesh over arrays and a tree built earlier, with the triangles already
+    // in the tree's leaf order.
+    triangle_mesh(const mesh_view &mesh, const wide_bvh_view &tree, const aabb &bbox, shared_ptr<material> mat)
+        : mat(mat), mesh(mesh), tree(tree), bbox(bbox) {}
+
+    // The views point into this object's own buffers.
+    triangle_mesh(const triangle_mesh &) = delete;
+    triangle_mesh &operator=(const triangle_mesh &) = delete;
+
+    bool hit(const ray &r, interval ray_t, hit_record &rec) const override {
+        watertight_ray wr(r);
+        uint32_t hit_triangle = 0;
+        double closest = 0, b0 = 0, b1 = 0, b2 = 0;
+
+        bool hit_anything = tree.hit(r, ray_t, [&](uint32_t index, interval &t) {
+            double t_hit, e0, e1, e2;
+            if (!intersect(wr, index, t, t_hit, e0, e1, e2))
+                return false;
+            t.max = closest = t_hit;
+            hit_triangle = index;
+            b0 = e0;
+            b1 = e1;
+            b2 = e2;
+            return true;
+        });
+
+        if (!hit_anything)
+            return false;
+
+        fill_hit_record(r, closest, hit_triangle, b0, b1, b2, rec);
+        return true;
+    }
+
+    bool occluded(const ray &r, interval ray_t) const override {
+        watertight_ray wr(r);
+        return tree.occluded(r, ray_t, [&](uint32_t index) {
+            double t_hit, e0, e1, e2;
+            return intersect(wr, index, ray_t, t_hit, e0, e1, e2);
+        });
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    size_t triangle_count() const {
+        return mesh.triangle_count;
+    }
+
+    const mesh_view &view() const {
+        return mesh;
+    }
+
+    const wide_bvh_view &tree_view() const {
+        return tree;
+    }
+
+    const shared_ptr<material> &mesh_material() const {
+        return mat;
+    }
+
+private:
+    mesh_buffers buffers; // empty if the arrays belong to someone else
+    wide_bvh owned_tree;
+    shared_ptr<material> mat;
+    mesh_view mesh;
+    wide_bvh_view tree;
+    aabb bbox;
+
+    // The per-ray half of the watertight ray-triangle test (Woop, Benthin
+    // and Wald, "Watertight Ray/Triangle Intersection", 2013): a permutation
+    // of the axes making z the dominant direction, and a shear that maps the
+    // ray onto the +z axis.
+    struct watertight_ray {
+        point3 origin;
+        int kx, ky, kz;
+        double sx, sy, sz;
+
+        explicit watertight_ray(const ray &r) : origin(r.origin()) {
+            const vec3 &d = r.direction();
+            kz = std::fabs(d.x()) > std::fabs(d.y())
+               ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2)
+               : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+
+            sx = -d[kx] / d[kz];
+            sy = -d[ky] / d[kz];
+            sz = 1.0 / d[kz];
+        }
+    };
+
+    // Intersects triangle index with the ray. On a hit within ray_t, returns
+    // the ray parameter and the barycentric coordinates of the hit point.
+    // Rays through an edge or vertex shared by two triangles hit at least one
+    // of them, since both evaluate the same edge function the same way.
+    bool intersect(const watertight_ray &wr, uint32_t index, const interval &ray_t,
+                   double &t, double &b0, double &b1, double &b2) const {
+        const auto *positions = mesh.positions;
+        const auto *tri = &mesh.indices[3 * static_cast<size_t>(index)];
+
+        vec3 p0 = positions[tri[0]] - wr.origin;
+        vec3 p1 = positions[tri[1]] - wr.origin;
+        vec3 p2 = positions[tri[2]] - wr.origin;
+
+        // Shear so the ray runs along +z from the origin.
+        auto p0x = p0[wr.kx] + wr.sx * p0[wr.kz], p0y = p0[wr.ky] + wr.sy * p0[wr.kz];
+        auto p1x = p1[wr.kx] + wr.sx * p1[wr.kz], p1y = p1[wr.ky] + wr.sy * p1[wr.kz];
+        auto p2x = p2[wr.kx] + wr.sx * p2[wr.kz], p2y = p2[wr.ky] + wr.sy * p2[wr.kz];
+
+        // Edge functions: signed areas of the ray's projection against each edge.
+        auto e0 = p1x * p2y - p1y * p2x;
+        auto e1 = p2x * p0y - p2y * p0x;
+        auto e2 = p0x * p1y - p0y * p1x;
+
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+            return false;
+
+        auto det = e0 + e1 + e2;
+        if (det == 0)
+            return false;
+
+        auto t_scaled = (e0 * p0[wr.kz] + e1 * p1[wr.kz] + e2 * p2[wr.kz]) * wr.sz;
+        t = t_scaled / det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        b0 = e0 / det;
+        b1 = e1 / det;
+        b2 = e2 / det;
+        return true;
+    }
+
+    void fill_hit_record(const ray &r, double t, uint32_t index, double b0, double b1, double b2,
+                         hit_record &rec) const {
+        const auto *tri = &mesh.indices[3 * static_cast<size_t>(index)];
+        const auto &p0 = mesh.positions[tri[0]];
+        const auto &p1 = mesh.positions[tri[1]];
+        const auto &p2 = mesh.positions[tri[2]];
+
+        // Interpolating the vertices places the point on the triangle more
+        // precisely than stepping t along the ray.
+        rec.t = t;
+        rec.p = b0 * p0 + b1 * p1 + b2 * p2;
+        rec.set_material(mat.get());
+
+        if (mesh.uvs) {
+            auto uv = b0 * mesh.uvs[tri[0]] + b1 * mesh.uvs[tri[1]] + b2 * mesh.uvs[tri[2]];
+            rec.u = uv.x();
+            rec.v = uv.y();
+        } else {
+            rec.u = b1;
+            rec.v = b2;
+        }
+
+        // Which side was hit is decided by the true surface, but the normal
+        // reported is the smooth one when the mesh has vertex normals.
+        auto geometric = unit_vector(cross(p1 - p0, p2 - p0));
+        rec.set_face_normal(r, geometric);
+        if (mesh.normals) {
+            auto shading = b0 * mesh.normals[tri[0]] + b1 * mesh.normals[tri[1]] + b2 * mesh.normals[tri[2]];
+            if (shading.length_squared() > 0) {
+                shading = unit_vector(shading);
+                if (dot(shading, geometric) < 0)
+                    shading = -shading;
+                rec.normal = rec.front_face ? shading : -shading;
+            }
+        }
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -19,8 +20,64 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// Random numbers
+
+// Finalizer from SplitMix64; scrambles a counter into a well-mixed 64-bit value.
+inline uint64_t mix_bits(uint64_t v) {
+	v ^= v >> 31;
+	v *= 0x7fb5d329728ea185ULL;
+	v ^= v >> 27;
+	v *= 0x81dadef4bc2dd44dULL;
+	v ^= v >> 33;
+	return v;
+}
+
+// PCG32 (O'Neill, XSH-RR variant). 16 bytes of state and no shared globals.
+class pcg32 {
+public:
+	pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+	pcg32(uint64_t init_state, uint64_t stream) { seed(init_state, stream); }
+
+	void seed(uint64_t init_state, uint64_t stream) {
+		state = 0;
+		inc = (stream << 1) | 1;
+		next_uint();
+		state += init_state;
+		next_uint();
+	}
+
+	uint32_t next_uint() {
+		uint64_t old_state = state;
+		state = old_state * 6364136223846793005ULL + inc;
+		auto xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+		auto rot = static_cast<uint32_t>(old_state >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((~rot + 1) & 31));
+	}
+
+	// Uniform in [0, 1).
+	double next_double() {
+		return next_uint() * 0x1p-32;
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+inline pcg32 &thread_rng() {
+	thread_local pcg32 rng;
+	return rng;
+}
+
+// Restarts this thread's generator at a point fixed by (seed, stream), so
+// that scene setup code drawing from it builds the same scene every run.
+// Rendering takes its numbers from a sampler instead (see sampler.h).
+inline void seed_random(uint64_t seed, uint64_t stream) {
+	thread_rng().seed(mix_bits(seed), mix_bits(stream));
+}
+
 inline double random_double() {
-	return rand() / (RAND_MAX + 1.0);
+	return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -132,9 +132,39 @@ inline vec3 random_on_hemisphere(const vec3 &normal) {
 		return -on_unit_sphere;
 }
 
-inline vec3 random_cosine_direction() {
-	auto r1 = random_double();
-	auto r2 = random_double();
+// The sample_* functions map a 2D sample u, in [0, 1)^2 as u.x() and u.y(),
+// onto a shape, so that evenly spread samples stay evenly spread.
+
+// A point in the unit disk (Shirley-Chiu concentric mapping).
+inline vec3 sample_unit_disk(const vec3 &u) {
+	auto a = 2 * u.x() - 1;
+	auto b = 2 * u.y() - 1;
+	if (a == 0 && b == 0)
+		return vec3(0, 0, 0);
+
+	double r, theta;
+	if (std::fabs(a) > std::fabs(b)) {
+		r = a;
+		theta = (pi / 4) * (b / a);
+	} else {
+		r = b;
+		theta = (pi / 2) - (pi / 4) * (a / b);
+	}
+	return vec3(r * std::cos(theta), r * std::sin(theta), 0);
+}
+
+// A direction uniformly distributed over the unit sphere.
+inline vec3 sample_unit_vector(const vec3 &u) {
+	auto z = 1 - 2 * u.x();
+	auto r = std::sqrt(std::fmax(0.0, 1 - z * z));
+	auto phi = 2 * pi * u.y();
+	return vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// A direction about +z, distributed by cos(theta) / pi.
+inline vec3 sample_cosine_direction(const vec3 &u) {
+	auto r1 = u.x();
+	auto r2 = u.y();
 
 	auto phi = 2 * pi * r1;
 	auto x = std::cos(phi) * std::sqrt(r2);
@@ -144,6 +174,12 @@ inline vec3 random_cosine_direction() {
 	return vec3(x, y, z);
 }
 
+inline vec3 random_cosine_direction() {
+	auto r1 = random_double();
+	auto r2 = random_double();
+	return sample_cosine_direction(vec3(r1, r2, 0));
+}
+
 inline vec3 reflect(const vec3 &v, const vec3 &n) {
 	return v - 2 * dot(v, n) * n;
 }
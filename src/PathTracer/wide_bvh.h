@@ -0,0 +1,421 @@
+#pragma once
+
+#include "util.h"
+
+#include "bvh.h"
+
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PATHTRACER_WIDE_BVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+// One node of a four-wide BVH. The bounds of all four children are stored
+// axis by axis, so one SIMD instruction handles the same plane of every
+// child. A child is either another node or a leaf's primitive range,
+// [child, child + prim_count); slots past child_count are unused.
+struct alignas(64) wide_bvh_node {
+    static constexpr int width = 4;
+
+    float bounds_min[3][width];
+    float bounds_max[3][width];
+    uint32_t child[width];
+    uint16_t prim_count[width]; // 0 for interior children
+    uint8_t child_count;
+    uint8_t pad[7];
+
+    aabb child_box(int c) const {
+        return aabb(interval(bounds_min[0][c], bounds_max[0][c]),
+                    interval(bounds_min[1][c], bounds_max[1][c]),
+                    interval(bounds_min[2][c], bounds_max[2][c]));
+    }
+
+    aabb box() const {
+        aabb b = aabb::empty;
+        for (int c = 0; c < child_count; c++)
+            b = aabb(b, child_box(c));
+        return b;
+    }
+};
+
+static_assert(sizeof(wide_bvh_node) == 128, "wide_bvh_node should fill two cache lines");
+
+// Traces rays through the nodes of a wide_bvh, wherever they are stored: in
+// the wide_bvh that built them or in a mapped scene file. It owns nothing and
+// is cheap to copy.
+struct wide_bvh_view {
+    const wide_bvh_node *nodes = nullptr;
+    size_t node_count = 0;
+
+    // Same contract as linear_bvh::hit. Children are visited nearest first,
+    // and any whose entry point lies beyond the closest hit found so far are
+    // skipped.
+    template <typename HitFn>
+    bool hit(const ray &r, interval ray_t, HitFn &&hit_primitive) const {
+        if (node_count == 0)
+            return false;
+
+        ray_planes planes(r);
+        float t_min = round_down(ray_t.min);
+        float t_max = round_up(ray_t.max);
+        stack_entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, -std::numeric_limits<float>::infinity() };
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            auto entry = stack[--stack_size];
+            if (entry.t_enter > ray_t.max)
+                continue;
+
+            if (entry.prim_count > 0) {
+                bool hit_leaf = false;
+                for (uint32_t i = 0; i < entry.prim_count; i++) {
+                    if (hit_primitive(entry.index + i, ray_t))
+                        hit_leaf = true;
+                }
+                if (hit_leaf) {
+                    hit_anything = true;
+                    t_max = round_up(ray_t.max);
+                }
+                continue;
+            }
+
+            const wide_bvh_node &node = nodes[entry.index];
+            float t_enter[wide_bvh_node::width];
+            int mask = intersect_children(node, planes, t_min, t_max, t_enter);
+
+            // Insert the children hit into a short list, farthest first, and
+            // push them in that order so the nearest is popped next.
+            int sorted[wide_bvh_node::width];
+            int count = 0;
+            for (int c = 0; c < wide_bvh_node::width; c++) {
+                if (!(mask & (1 << c)))
+                    continue;
+                int k = count++;
+                for (; k > 0 && t_enter[sorted[k - 1]] < t_enter[c]; k--)
+                    sorted[k] = sorted[k - 1];
+                sorted[k] = c;
+            }
+            for (int k = 0; k < count; k++) {
+                int c = sorted[k];
+                assert(stack_size < stack_capacity);
+                stack[stack_size++] = { node.child[c], node.prim_count[c], t_enter[c] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // Same contract as linear_bvh::occluded. Order doesn't matter for an
+    // any-hit query, so children are pushed as they come.
+    template <typename AnyHitFn>
+    bool occluded(const ray &r, interval ray_t, AnyHitFn &&occluded_primitive) const {
+        if (node_count == 0)
+            return false;
+
+        ray_planes planes(r);
+        float t_min = round_down(ray_t.min);
+        float t_max = round_up(ray_t.max);
+        uint32_t stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const wide_bvh_node &node = nodes[stack[--stack_size]];
+            float t_enter[wide_bvh_node::width];
+            int mask = intersect_children(node, planes, t_min, t_max, t_enter);
+
+            for (int c = 0; c < wide_bvh_node::width; c++) {
+                if (!(mask & (1 << c)))
+                    continue;
+                if (node.prim_count[c] == 0) {
+                    assert(stack_size < stack_capacity);
+                    stack[stack_size++] = node.child[c];
+                    continue;
+                }
+                for (uint32_t i = 0; i < node.prim_count[c]; i++) {
+                    if (occluded_primitive(node.child[c] + i))
+                        return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    aabb bounding_box() const {
+        if (node_count == 0)
+            return aabb::empty;
+        return nodes[0].box();
+    }
+
+    // Expected cost of tracing a ray through the tree, as linear_bvh::sah_cost,
+    // with the build's relative costs of testing a primitive and visiting a
+    // node.
+    double sah_cost(double leaf_cost = 1.0, double node_cost = 1.0) const {
+        if (node_count == 0)
+            return 0.0;
+
+        auto root_area = surface_area(bounding_box());
+        if (root_area <= 0)
+            return 0.0;
+
+        double cost = 0.0;
+        for (size_t n = 0; n < node_count; n++) {
+            const auto &node = nodes[n];
+            cost += node_cost * surface_area(node.box()) / root_area;
+            for (int c = 0; c < node.child_count; c++) {
+                if (node.prim_count[c] > 0)
+                    cost += leaf_cost * node.prim_count[c] * surface_area(node.child_box(c)) / root_area;
+            }
+        }
+        return cost;
+    }
+
+private:
+    // Every level pops one entry and pushes at most four, so a path of
+    // linear_bvh::max_depth levels leaves at most three behind per level.
+    static constexpr int stack_capacity = 4 * linear_bvh::max_depth;
+
+    static double surface_area(const aabb &box) {
+        if (box.x.size() < 0)
+            return 0.0;
+        auto dx = box.x.size(), dy = box.y.size(), dz = box.z.size();
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    struct stack_entry {
+        uint32_t index;      // node index, or first primitive of a leaf
+        uint32_t prim_count; // 0 for nodes
+        float t_enter;       // where the ray enters its bounds
+    };
+
+    // A ray's origin and reciprocal direction in single precision, for
+    // testing it against float node bounds, and the sign of each direction
+    // component, which picks the near and far plane of every slab. The origin
+    // is rounded so the near distance can only come out smaller and the far
+    // one larger, so rounding never loses a hit.
+    struct ray_planes {
+        float near_origin[3];
+        float far_origin[3];
+        float inv_dir[3];
+        int sign[3];
+
+        explicit ray_planes(const ray &r) {
+            for (int axis = 0; axis < 3; axis++) {
+                double o = r.origin()[axis];
+                sign[axis] = r.direction_sign(axis);
+                near_origin[axis] = sign[axis] ? round_down(o) : round_up(o);
+                far_origin[axis] = sign[axis] ? round_up(o) : round_down(o);
+                inv_dir[axis] = static_cast<float>(r.inv_direction()[axis]);
+            }
+        }
+    };
+
+    // Scales exit distances up to cover the rounding error of the float slab
+    // computation (Ize, "Robust BVH Ray Traversal", 2013).
+    static constexpr float exit_scale = 1.0f + 2.0f * (3.0f * FLT_EPSILON / 2) / (1.0f - 3.0f * FLT_EPSILON / 2);
+
+    // A float no greater, or no less, than x. Converting x is off by at most
+    // half a unit in the last place; the result is moved a whole unit
+    // further, by arithmetic rather than a branch on which way it rounded.
+    static float round_down(double x) {
+        auto f = static_cast<float>(x);
+        return f - std::fabs(f) * FLT_EPSILON;
+    }
+
+    static float round_up(double x) {
+        auto f = static_cast<float>(x);
+        return f + std::fabs(f) * FLT_EPSILON;
+    }
+
+    // Tests the ray against every child of node within [ray_min, ray_max].
+    // Returns a bit per child hit, and the entry distance of each in t_enter.
+    static int intersect_children(const wide_bvh_node &node, const ray_planes &planes, float ray_min, float ray_max,
+                                  float t_enter[wide_bvh_node::width]) {
+        static const int valid_mask[wide_bvh_node::width + 1] = { 0x0, 0x1, 0x3, 0x7, 0xf };
+
+#ifdef PATHTRACER_WIDE_BVH_SSE
+        __m128 t_min = _mm_set1_ps(ray_min);
+        __m128 t_max = _mm_set1_ps(ray_max);
+
+        for (int axis = 0; axis < 3; axis++) {
+            const float *near_bounds = planes.sign[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+            const float *far_bounds = planes.sign[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+
+            __m128 inv = _mm_set1_ps(planes.inv_dir[axis]);
+            __m128 t_near = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_bounds), _mm_set1_ps(planes.near_origin[axis])), inv);
+            __m128 t_far = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_bounds), _mm_set1_ps(planes.far_origin[axis])), inv);
+
+            // maxps and minps return their second operand if either is NaN,
+            // so the 0 * infinity of a ray running exactly along a plane
+            // leaves the interval unchanged.
+            t_min = _mm_max_ps(t_near, t_min);
+            t_max = _mm_min_ps(t_far, t_max);
+        }
+
+        _mm_storeu_ps(t_enter, t_min);
+        int mask = _mm_movemask_ps(_mm_cmple_ps(t_min, _mm_mul_ps(t_max, _mm_set1_ps(exit_scale))));
+        return mask & valid_mask[node.child_count];
+#else
+        int mask = 0;
+        for (int c = 0; c < node.child_count; c++) {
+            float t_min = ray_min;
+            float t_max = ray_max;
+
+            for (int axis = 0; axis < 3; axis++) {
+                int sign = planes.sign[axis];
+                float t_near = ((sign ? node.bounds_max : node.bounds_min)[axis][c] - planes.near_origin[axis]) * planes.inv_dir[axis];
+                float t_far = ((sign ? node.bounds_min : node.bounds_max)[axis][c] - planes.far_origin[axis]) * planes.inv_dir[axis];
+
+                t_min = t_near > t_min ? t_near : t_min;
+                t_max = t_far < t_max ? t_far : t_max;
+            }
+
+            t_enter[c] = t_min;
+            if (t_min <= t_max * exit_scale)
+                mask |= 1 << c;
+        }
+        return mask & valid_mask[node.child_count];
+#endif
+    }
+};
+
+// A BVH with four children per node, made by collapsing a binary linear_bvh:
+// each node absorbs its largest interior descendants until it has four
+// children. The primitive order, and so every leaf's range, is the binary
+// tree's. Tracing tests a ray against all four children of a node at once
+// with SSE where available, or with a scalar loop otherwise, and visits the
+// children it hits from nearest to farthest.
+class wide_bvh {
+public:
+    std::vector<wide_bvh_node> nodes;
+
+    // Builds the tree over prim_bounds and returns, in leaf order, the index
+    // of the primitive that should sit in each slot, like linear_bvh::build.
+    std::vector<uint32_t> build(const std::vector<aabb> &prim_bounds, const bvh_build_options &options = {}) {
+        nodes.clear();
+
+        linear_bvh binary;
+        auto order = binary.build(prim_bounds, options);
+        if (!binary.nodes.empty()) {
+            nodes.reserve(binary.nodes.size() / 2 + 1);
+            collapse(binary, 0);
+        }
+
+        leaf_cost = options.intersection_cost;
+        node_cost = options.traversal_cost;
+        return order;
+    }
+
+    wide_bvh_view view() const {
+        return { nodes.data(), nodes.size() };
+    }
+
+    // Expected cost of tracing a ray through the tree, as linear_bvh::sah_cost.
+    double sah_cost() const {
+        return view().sah_cost(leaf_cost, node_cost);
+    }
+
+    template <typename HitFn>
+    bool hit(const ray &r, interval ray_t, HitFn &&hit_primitive) const {
+        return view().hit(r, ray_t, hit_primitive);
+    }
+
+    template <typename AnyHitFn>
+    bool occluded(const ray &r, interval ray_t, AnyHitFn &&occluded_primitive) const {
+        return view().occluded(r, ray_t, occluded_primitive);
+    }
+
+    aabb bounding_box() const {
+        return view().bounding_box();
+    }
+
+private:
+    double leaf_cost = 1.0;
+    double node_cost = 1.0;
+
+    // Turns the binary subtree at binary_index, which must be an interior
+    // node or the root, into a wide node and its descendants, and returns its
+    // index.
+    uint32_t collapse(const linear_bvh &binary, uint32_t binary_index) {
+        // Start from the node's two children and repeatedly open up the
+        // interior one with the largest surface area.
+        uint32_t children[wide_bvh_node::width];
+        int count = 0;
+        const auto &top = binary.nodes[binary_index];
+        if (top.prim_count > 0) {
+            children[count++] = binary_index;
+        } else {
+            children[count++] = binary_index + 1;
+            children[count++] = top.offset;
+        }
+
+        while (count < wide_bvh_node::width) {
+            int best = -1;
+            double best_area = -1;
+            for (int c = 0; c < count; c++) {
+                const auto &n = binary.nodes[children[c]];
+                if (n.prim_count > 0)
+                    continue;
+                auto area = binary_area(n);
+                if (area > best_area) {
+                    best = c;
+                    best_area = area;
+                }
+            }
+            if (best < 0)
+                break;
+
+            auto opened = children[best];
+            for (int c = count; c > best + 1; c--)
+                children[c] = children[c - 1];
+            children[best] = opened + 1;
+            children[best + 1] = binary.nodes[opened].offset;
+            count++;
+        }
+
+        auto index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        {
+            auto &node = nodes[index];
+            node.child_count = static_cast<uint8_t>(count);
+            for (int c = 0; c < wide_bvh_node::width; c++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    node.bounds_min[axis][c] = std::numeric_limits<float>::infinity();
+                    node.bounds_max[axis][c] = -std::numeric_limits<float>::infinity();
+                }
+                node.child[c] = 0;
+                node.prim_count[c] = 0;
+            }
+            for (auto &p : node.pad)
+                p = 0;
+        }
+
+        for (int c = 0; c < count; c++) {
+            const auto &b = binary.nodes[children[c]];
+            uint32_t child = b.prim_count > 0 ? b.offset : collapse(binary, children[c]);
+
+            auto &node = nodes[index];
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds_min[axis][c] = b.bounds_min[axis];
+                node.bounds_max[axis][c] = b.bounds_max[axis];
+            }
+            node.child[c] = child;
+            node.prim_count[c] = b.prim_count;
+        }
+
+        return index;
+    }
+
+    static double binary_area(const linear_bvh_node &node) {
+        double d[3];
+        for (int axis = 0; axis < 3; axis++)
+            d[axis] = static_cast<double>(node.bounds_max[axis]) - node.bounds_min[axis];
+        return 2.0 * (d[0] * d[1] + d[1] * d[2] + d[2] * d[0]);
+    }
+};